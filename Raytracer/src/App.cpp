@@ -26,7 +26,8 @@ RayTracer::RayTracer() {
 
 	texture = SDL_CreateTexture(renderer, SDL_PixelFormatEnum::SDL_PIXELFORMAT_RGBA8888, SDL_TextureAccess::SDL_TEXTUREACCESS_TARGET, WINDOW_WIDTH, WINDOW_HEIGHT);
 
-	SDL_SetRelativeMouseMode(SDL_TRUE);
+	// The mouse turns the camera, otherwise the cursor stays visible
+	SDL_SetRelativeMouseMode(CAN_MOVE_CAMERA ? SDL_TRUE : SDL_FALSE);
 }
 RayTracer::~RayTracer() {
 	SDL_DestroyTexture(texture);
@@ -38,7 +39,7 @@ RayTracer::~RayTracer() {
 void RayTracer::Loop() {
 
 	// Render at start
-	frameManager.StartNewFrame();
+	frameManager.StartNewFrame(camera);
 
 	SDL_Event event;
 	while (programOpen) {
@@ -49,8 +50,15 @@ void RayTracer::Loop() {
 		needReRendering |= HandleMovement();
 		PresentRender();
 
-		if (needReRendering)
-			frameManager.StartNewFrame();
+#if WORLD_UPDATE_INTERVAL > 0
+		if (++framesSinceWorldUpdate >= WORLD_UPDATE_INTERVAL) {
+			frameManager.AdvanceWorldTime();
+			framesSinceWorldUpdate = 0;
+		}
+#endif
+
+		if (needReRendering || frameManager.HasNewWorld())
+			frameManager.StartNewFrame(camera);
 
 		SleepForSteadyFPS();
 	}
@@ -75,8 +83,6 @@ void RayTracer::PresentRender() {
 	SDL_UpdateTexture(texture, NULL, pixels, WINDOW_WIDTH * 4);
 	SDL_RenderCopy(renderer, texture, &srcRect, &bounds);
 	SDL_RenderPresent(renderer);
-
-	frameManager.ContinueWorkingOnImage();
 }
 
 void RayTracer::SleepForSteadyFPS() {
@@ -93,11 +99,13 @@ bool RayTracer::HandleEvent(SDL_Event* e) {
 
 #if CAN_MOVE_CAMERA
 	if (e->type == SDL_MOUSEMOTION) {
-		World& world = frameManager.GetWorld();
-		Camera& camera = world.GetWorldCamera();
 		camera.SetForwardVector(camera.GetForwardVector() - MOUSE_SENSITIVITY * ((float)e->motion.xrel * camera.GetUDirection() + (float)e->motion.yrel * camera.GetVDirection()));
 		return true;
 	}
+#else
+	// The previews are sharpest where the cursor is. The image doesn't change, so no new frame is needed
+	if (e->type == SDL_MOUSEMOTION)
+		frameManager.SetPointOfInterest({ (float)e->motion.x, (float)e->motion.y });
 #endif
 
 	return false;
@@ -105,11 +113,8 @@ bool RayTracer::HandleEvent(SDL_Event* e) {
 
 bool RayTracer::HandleMovement() {
 	const Uint8* keystate = SDL_GetKeyboardState(NULL);
-	World& world = frameManager.GetWorld();
 	bool renderAgain = false;
 
-	Camera& camera = world.GetWorldCamera();
-
 #if CAN_MOVE_CAMERA
 	if (keystate[SDL_SCANCODE_D]) {
 		glm::vec3 dir = camera.GetUDirection();
@@ -16,9 +16,12 @@ public:
 	~RayTracer();
 private:
 	bool programOpen = false;
+	int framesSinceWorldUpdate = 0;
 	std::chrono::time_point<std::chrono::steady_clock> lastExecution;
 
 	FrameManager frameManager;
+	// Only changed by the UI thread. The render threads get a copy with every new frame
+	Camera camera = Camera({ 0, 3, -10 }, { 0, 0, 1 });
 
 	SDL_Window* window = nullptr;
 	SDL_Renderer* renderer = nullptr;
@@ -3,18 +3,44 @@
 //  PROGRAM  //
 #define WINDOW_WIDTH 1280                  /* Positive intiger */
 #define WINDOW_HEIGHT 720                  /* Positive intiger */
-#define THREAD_COUNT 7                     /* Positive intiger */
+#define THREAD_COUNT 0                     /* 0 = One per logical core, minus THREAD_RESERVE */
+#define THREAD_RESERVE 1                   /* Cores left for the UI thread and the OS */
+#define PIN_THREADS_TO_CORES 0             /*      0 || 1      */
+#define WORLD_UPDATE_INTERVAL 0            /* Frames between building the world with a new time in the background, 0 = never */
 #define FPS 24                             /* Positive intiger */
-#define PIXEL_CALCULATING_OREDER_SPREAD 37 /* Positive intiger */
+#define TILE_SIZE 16                       /* Power of two  */
+#define TILE_CALCULATING_ORDER_SPREAD 37   /* Positive intiger */
+#define FOVEATED_RENDERING 1               /* Tiles near the point of interest first and with more samples. It is the cursor when the camera can't move */
+#define FOVEA_RADIUS 0.2f                  /* Part of the window height */
+#define WAVEFRONT_RENDERING 1              /* Full resolution tiles trace all their paths together in stages */
+#define PACKET_TRACING 1                   /* Wavefront camera rays go through the scene in packets of four */
+#define SORT_SECONDARY_RAYS 0              /* Wavefront bounces are traced in order of direction and origin */
+#define DETERMINISTIC_RENDERING 0          /* Random numbers are seeded by pixel, sample, bounce and frame. Same image on any thread count */
 #define LOG_BENCHMARK 1                    /*      0 || 1      */
 
 //  QUALITY  //
 #define FIELD_OF_VIEW 1.5f
 #define SKYBOX_BRIGHTNESS 0.5f
+#define SAMPLE_SKYBOX 1 /* Light samples also aim at the bright parts of the skybox */
 #define DEPTH_OF_FIELD_INTENSITY 0.05f
 #define FOCUS_DISTANCE 10.0f
-#define LIGHT_BOUNCE_AMOUNT 3
+#define LIGHT_BOUNCE_AMOUNT 8 /* Most bounces of a path */
+#define RUSSIAN_ROULETTE_DEPTH 3 /* Bounces after which paths that carry little light can end early */
 #define SAMPLES_PER_PIXEL_AXIS 3 /* This number squared, since it is looped for both axis */
+#define SAMPLER 2 /* 0 = Independent random, 1 = Stratified, 2 = Owen scrambled Sobol, 3 = Blue noise */
+#define PREVIEW_PASS_COUNT 4 /* One sample per block of pixels, the first pass has blocks of 2^(count-1). Max log2(TILE_SIZE)+1 */
+#define FULL_QUALITY_DELAY 0.2f /* Seconds the camera has to stay still before calculating with all samples */
+#define DYNAMIC_RESOLUTION 1 /* Lowers the resolution of the previews to reach FPS, or raises their samples if there's time */
+#define MIN_RENDER_SCALE 0.25f
+#define RENDER_TIME_BUDGET 0.8f /* Part of a frame's time the previews can take */
+#define PROGRESSIVE_REFINEMENT 1 /* A still camera keeps adding passes of samples to the image */
+#define REFINEMENT_TOLERANCE 1 /* A tile is done when a pass changes none of its pixels by more than this, out of 255 */
+#define REFINEMENT_TIME_LIMIT 30.0f /* Seconds of still camera after which the image isn't refined anymore */
+#define DETERMINISTIC_REFINEMENT_PASSES 64 /* Most refinement passes with DETERMINISTIC_RENDERING, which can't use the time limit */
+
+//  SCENE  //
+#define SDF_DEMO 0 /* Adds a blob traced by its signed distance field to the default scene */
+#define SPHERE_CLOUD_DEMO 0 /* Adds a field of 50000 pebbles behind the tree to the default scene */
 
 //  GAMEPLAY  //
 #define CAN_MOVE_CAMERA true
@@ -5,6 +5,9 @@
 #include <string>
 #include <iostream>
 
+#if defined(__AVX__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 
 void Camera::SetForwardVector(const glm::vec3& lookVector) {
@@ -25,12 +28,115 @@ Skybox::Skybox(const std::string& filepath) {
 		std::cout << "The skybox had " << channels << " channels instead of 3." << std::endl;
 		__debugbreak();
 	}
+
+	std::vector<float> luminances(size.x * size.y);
+	for (uint32_t y = 0; y < size.y; y++) {
+		for (uint32_t x = 0; x < size.x; x++)
+			luminances[y * size.x + x] = GetLuminance(GetPixel(x, y));
+	}
+	distribution.Build(luminances);
 }
 
 Skybox::~Skybox() {
 	stbi_image_free(skyboxImageData);
 }
 
+inline uint32_t Skybox::GetPixelIndex(const glm::vec3& direction) const {
+	glm::vec2 uv = glm::vec2(glm::atan(direction.x, direction.z) / (2*glm::pi<float>()) + 0.5f, direction.y * 0.5f + 0.5f);
+	uint32_t x = glm::min((uint32_t)(uv.x * size.x), size.x - 1);
+	uint32_t y = glm::min((uint32_t)(uv.y * size.y), size.y - 1);
+	return y * size.x + x;
+}
+glm::vec3 Skybox::GetPixel(const glm::vec3& direction) const {
+	const uint32_t index = GetPixelIndex(direction);
+	return GetPixel(index % size.x, index / size.x);
+}
+glm::vec3 Skybox::GetPixel(int x, int y) const {
+	int index = 3 * (int)(y * size.x + x);
+	uint8_t c1 = skyboxImageData[index];
+	uint8_t c2 = skyboxImageData[index + 1];
+	uint8_t c3 = skyboxImageData[index + 2];
+
+	float f1 = c1;
+	float f2 = c2;
+	float f3 = c3;
+
+	return glm::vec3{ f1, f2, f3 } / 255.0f;
+}
+
+glm::vec3 Skybox::SampleDirection(glm::vec2 sample, float& outPdf) const {
+	const uint32_t index = distribution.Sample(sample.x);
+	const glm::vec2 uv = { (index % size.x + sample.x) / size.x, (index / size.x + sample.y) / size.y };
+	outPdf = distribution.GetProbability(index) * size.x * size.y / (4.0f * glm::pi<float>());
+
+	// The inverse of GetPixelIndex
+	const float angle = (uv.x - 0.5f) * 2.0f * glm::pi<float>();
+	const float height = uv.y * 2.0f - 1.0f;
+	const float radius = glm::sqrt(glm::max((1.0f - height) * (1.0f + height), 0.0f));
+	return { radius * glm::sin(angle), height, radius * glm::cos(angle) };
+}
+
+float Skybox::GetPdf(const glm::vec3& direction) const {
+	if (distribution.IsEmpty())
+		return 0;
+	return distribution.GetProbability(GetPixelIndex(direction)) * size.x * size.y / (4.0f * glm::pi<float>());
+}
+
+bool AliasTable::Build(const std::vector<float>& weights) {
+	entries.clear();
+	probabilities.clear();
+	double sum = 0;
+	for (float weight : weights)
+		sum += weight;
+	if (sum <= 0)
+		return false;
+
+	// Bins with less than the mean weight get filled up to it from the bins with more
+	const uint32_t count = (uint32_t)weights.size();
+	entries.resize(count);
+	probabilities.resize(count);
+	std::vector<float> scaled(count);
+	std::vector<uint32_t> small, large;
+	for (uint32_t i = 0; i < count; i++) {
+		probabilities[i] = (float)(weights[i] / sum);
+		scaled[i] = (float)(weights[i] * count / sum);
+		(scaled[i] < 1.0f ? small : large).push_back(i);
+	}
+	while (!small.empty() && !large.empty()) {
+		const uint32_t less = small.back();
+		const uint32_t more = large.back();
+		small.pop_back();
+		entries[less] = { scaled[less], more };
+
+		scaled[more] -= 1.0f - scaled[less];
+		if (scaled[more] < 1.0f) {
+			large.pop_back();
+			small.push_back(more);
+		}
+	}
+	// What is left is full up to rounding
+	for (uint32_t i : small)
+		entries[i] = { 1.0f, i };
+	for (uint32_t i : large)
+		entries[i] = { 1.0f, i };
+	return true;
+}
+
+uint32_t AliasTable::Sample(float& sample) const {
+	const float scaled = sample * entries.size();
+	const uint32_t bin = glm::min((uint32_t)scaled, (uint32_t)entries.size() - 1);
+	const Entry& entry = entries[bin];
+	const float remainder = scaled - bin;
+
+	const float largestBelowOne = 0x1.fffffep-1f;
+	if (remainder < entry.threshold) {
+		sample = glm::min(remainder / entry.threshold, largestBelowOne);
+		return bin;
+	}
+	sample = glm::min((remainder - entry.threshold) / (1.0f - entry.threshold), largestBelowOne);
+	return entry.alias;
+}
+
 // Can do some optimizing https://www.scratchapixel.com/lessons/3d-basic-rendering/minimal-ray-tracer-rendering-simple-shapes/ray-box-intersection
 bool BoundingBox::DoesRayHit(const Ray& r) const {
 	float tmin, tmax, tymin, tymax, tzmin, tzmax;
@@ -81,6 +187,97 @@ bool BoundingBox::DoesRayHit(const Ray& r) const {
 	return true;
 }
 
+bool BoundingBox::GetRayHitDistances(const Ray& r, float& outTMin, float& outTMax) const {
+	glm::vec3 inverseDirection = 1.0f / r.direction;
+	glm::vec3 t0 = (minCoord - r.pos) * inverseDirection;
+	glm::vec3 t1 = (maxCoord - r.pos) * inverseDirection;
+	glm::vec3 tSmaller = glm::min(t0, t1);
+	glm::vec3 tBigger = glm::max(t0, t1);
+
+	outTMin = glm::max(tSmaller.x, glm::max(tSmaller.y, tSmaller.z));
+	outTMax = glm::min(tBigger.x, glm::min(tBigger.y, tBigger.z));
+	return outTMin <= outTMax && outTMax >= 0.0f;
+}
+
+void Random8::Next01(float* out, uint32_t activeMask) {
+#if defined(__AVX2__)
+	const __m256i multiplierLow = _mm256_set1_epi64x(Random::MULTIPLIER & 0xFFFFFFFF);
+	const __m256i multiplierHigh = _mm256_set1_epi64x(Random::MULTIPLIER >> 32);
+	const __m256i increment = _mm256_set1_epi64x(Random::INCREMENT);
+
+	__m256i numbers[2];
+	for (int half = 0; half < 2; half++) {
+		__m256i old = _mm256_load_si256((const __m256i*)&states[half * 4]);
+
+		// 64 bit multiply from 32 bit ones, the high half of the product isn't needed
+		__m256i low = _mm256_mul_epu32(old, multiplierLow);
+		__m256i cross = _mm256_add_epi64(_mm256_mul_epu32(old, multiplierHigh), _mm256_mul_epu32(_mm256_srli_epi64(old, 32), multiplierLow));
+		__m256i next = _mm256_add_epi64(_mm256_add_epi64(low, _mm256_slli_epi64(cross, 32)), increment);
+
+		const __m256i laneBits = _mm256_set_epi64x(8, 4, 2, 1);
+		__m256i active = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_set1_epi64x(activeMask >> (half * 4)), laneBits), laneBits);
+		_mm256_store_si256((__m256i*)&states[half * 4], _mm256_blendv_epi8(old, next, active));
+
+		// Output permutation, in the low 32 bits of each lane
+		__m256i xorshifted = _mm256_srli_epi64(_mm256_xor_si256(_mm256_srli_epi64(old, 18), old), 27);
+		__m256i rotation = _mm256_srli_epi64(old, 59);
+		numbers[half] = _mm256_or_si256(_mm256_srlv_epi32(xorshifted, rotation),
+			_mm256_sllv_epi32(xorshifted, _mm256_and_si256(_mm256_sub_epi32(_mm256_set1_epi32(32), rotation), _mm256_set1_epi32(31))));
+	}
+
+	// Gather the low halves of the lanes in order
+	__m256i packed = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(numbers[0]), _mm256_castsi256_ps(numbers[1]), _MM_SHUFFLE(2, 0, 2, 0)));
+	packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+	__m256 floats = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(packed, 8)), _mm256_set1_ps(1.0f / (1 << 24)));
+
+	if (activeMask == 0xFF)
+		_mm256_storeu_ps(out, floats);
+	else {
+		const __m256i laneBits = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+		_mm256_maskstore_ps(out, _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int)activeMask), laneBits), laneBits), floats);
+	}
+#else
+	for (int lane = 0; lane < 8; lane++) {
+		if ((activeMask & (1 << lane)) == 0)
+			continue;
+
+		Random random;
+		random.state = states[lane];
+		out[lane] = random.Next01();
+		states[lane] = random.state;
+	}
+#endif
+}
+uint32_t BoundingBox::GetPacketHitMask(const RayPacket& packet, const float* maxDistances) const {
+#if defined(__AVX__)
+	__m128 t0X = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minCoord.x), _mm_load_ps(packet.posX)), _mm_load_ps(packet.inverseDirectionX));
+	__m128 t0Y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minCoord.y), _mm_load_ps(packet.posY)), _mm_load_ps(packet.inverseDirectionY));
+	__m128 t0Z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minCoord.z), _mm_load_ps(packet.posZ)), _mm_load_ps(packet.inverseDirectionZ));
+	__m128 t1X = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxCoord.x), _mm_load_ps(packet.posX)), _mm_load_ps(packet.inverseDirectionX));
+	__m128 t1Y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxCoord.y), _mm_load_ps(packet.posY)), _mm_load_ps(packet.inverseDirectionY));
+	__m128 t1Z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxCoord.z), _mm_load_ps(packet.posZ)), _mm_load_ps(packet.inverseDirectionZ));
+
+	__m128 entry = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0X, t1X), _mm_min_ps(t0Y, t1Y)), _mm_max_ps(_mm_min_ps(t0Z, t1Z), _mm_setzero_ps()));
+	__m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0X, t1X), _mm_max_ps(t0Y, t1Y)), _mm_min_ps(_mm_max_ps(t0Z, t1Z), _mm_loadu_ps(maxDistances)));
+	return (uint32_t)_mm_movemask_ps(_mm_cmple_ps(entry, exit));
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+		glm::vec3 inverseDirection = { packet.inverseDirectionX[i], packet.inverseDirectionY[i], packet.inverseDirectionZ[i] };
+		glm::vec3 t0 = (minCoord - glm::vec3(packet.posX[i], packet.posY[i], packet.posZ[i])) * inverseDirection;
+		glm::vec3 t1 = (maxCoord - glm::vec3(packet.posX[i], packet.posY[i], packet.posZ[i])) * inverseDirection;
+		glm::vec3 tSmaller = glm::min(t0, t1);
+		glm::vec3 tBigger = glm::max(t0, t1);
+
+		float entry = glm::max(glm::max(tSmaller.x, tSmaller.y), glm::max(tSmaller.z, 0.0f));
+		float exit = glm::min(glm::min(tBigger.x, tBigger.y), glm::min(tBigger.z, maxDistances[i]));
+		if (entry <= exit)
+			mask |= 1 << i;
+	}
+	return mask;
+#endif
+}
+
 glm::vec3 CheckeredTexture::GetColorValue(const glm::vec2& uv, const glm::vec3& p) const {
 	const float scale = 5.0f;
 
@@ -106,6 +303,9 @@ ImageTexture::ImageTexture(const std::string& path) {
 		std::cout << "An image had " << channels << " channels. Does the path exists?" << std::endl;
 		__debugbreak();
 	}
+
+	for (uint32_t i = 0; i < size.x * size.y && !hasHoles; i++)
+		hasHoles = (uint8_t)imageData[4 * i + 3] <= CLIP_VALUE;
 }
 ImageTexture::~ImageTexture() {
 	stbi_image_free(imageData);
@@ -121,7 +321,6 @@ glm::vec3 ImageTexture::GetColorValue(const glm::vec2& uv, const glm::vec3& p) c
 }
 
 bool ImageTexture::IsSolidInPosition(const glm::vec2& uv, const glm::vec3& p) const {
-	const float clipValue = 0.01f;
 	uint8_t alpha = imageData[GetIndexFromUV(uv) + 3];
-	return alpha > clipValue;
+	return alpha > CLIP_VALUE;
 }
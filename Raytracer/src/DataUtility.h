@@ -5,49 +5,86 @@
 #include <string>
 #include <memory>
 #include <iostream>
-
-#if 1
-#include <cstdlib>
-static float Random01() { return (float)std::rand() / RAND_MAX; }
-static float RandomUnitDistance() { return ((float)(std::rand() - RAND_MAX / 2) / (RAND_MAX / 2)); }
-#else
-#include <random>
-#include <chrono>
-static float Random01() {
-	static std::mt19937 rng(std::chrono::steady_clock::now().time_since_epoch().count());
-	static std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
-	return distribution(rng);
-}
-static float RandomUnitDistance() {
-	static std::mt19937 rng(std::chrono::steady_clock::now().time_since_epoch().count());
-	static std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
-	return distribution(rng);
+#include <thread>
+#include <vector>
+
+// PCG hash, a good spread of bits for very little work
+static inline uint32_t HashRandom(uint32_t value) {
+	uint32_t state = value * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
 }
-#endif
 
-static glm::vec3 GetRandomUnitSpherePoint() {
-	while (true) {
-		glm::vec3 sample = glm::vec3{ RandomUnitDistance(), RandomUnitDistance(), RandomUnitDistance() };
-		if (sample.x * sample.x + sample.y * sample.y + sample.z * sample.z < 1.0f)
-			return sample;
+// PCG32 by Melissa O'Neill. Only 8 bytes and quick to seed, so a sampler can start one for any sample.
+struct Random {
+	static constexpr uint64_t MULTIPLIER = 6364136223846793005ull;
+	static constexpr uint64_t INCREMENT = 1442695040888963407ull;
+
+	explicit Random(uint64_t seed = 0) : state(0) { NextUInt(); state += seed; NextUInt(); }
+
+	uint32_t NextUInt() {
+		uint64_t old = state;
+		state = old * MULTIPLIER + INCREMENT;
+		uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+		uint32_t rotation = (uint32_t)(old >> 59u);
+		return (xorshifted >> rotation) | (xorshifted << ((32 - rotation) & 31));
 	}
+	float Next01() { return (float)(NextUInt() >> 8) / (1 << 24); }  // 0 to 1, without 1
+	float NextUnitDistance() { return Next01() * 2.0f - 1.0f; }      // -1 to 1
+
+	uint64_t state;
+};
+
+// Eight Random generators stepped together with AVX2, for sampling a batch of paths at once.
+// A lane gives the same numbers as a Random with the same state.
+struct Random8 {
+	// Lanes without their bit in activeMask don't advance, and their number is left as it was
+	void Next01(float* out, uint32_t activeMask = 0xFF);
+
+	alignas(32) uint64_t states[8];
+};
+
+// For code that can't be given a generator, like the fog in Intersect. Starts differently on every thread.
+inline Random& GetThreadRandom() {
+	thread_local Random random(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	return random;
 }
-static glm::vec2 GetRandomUnitCirclePoint() {
-	while (true) {
-		glm::vec2 sample = { RandomUnitDistance(), RandomUnitDistance() };
-		if (sample.x * sample.x + sample.y * sample.y < 1.0f)
-			return sample;
-	}
+
+// Return: How bright the color looks
+static inline float GetLuminance(const glm::vec3& color) {
+	return glm::dot(color, glm::vec3{ 0.2126f, 0.7152f, 0.0722f });
+}
+
+// Return: The same seed every time for a sample of a pixel on a frame
+static inline uint32_t GetPathSeed(uint32_t pixel, uint32_t sample, uint32_t frame) {
+	return HashRandom(pixel ^ HashRandom(sample ^ HashRandom(frame)));
 }
 
 struct Ray {
 	Ray() = default;
 	Ray(glm::vec3 pos, glm::vec3 direction) : pos(pos), direction(direction) {}
+	// Starts a bit off the point, so the ray doesn't hit the surface it is leaving again
+	static Ray CreateFromSurface(const glm::vec3& point, const glm::vec3& direction) { return Ray(point + direction * 0.0001f, direction); }
 
 	glm::vec3 pos{ 0 };
 	glm::vec3 direction{ 0 };
 };
 
+// Rays traced through the scene together, one SIMD lane for each. They should be going about the same way.
+constexpr int RAY_PACKET_SIZE = 4;
+struct RayPacket {
+	void SetRay(int i, const Ray& ray) {
+		posX[i] = ray.pos.x; posY[i] = ray.pos.y; posZ[i] = ray.pos.z;
+		directionX[i] = ray.direction.x; directionY[i] = ray.direction.y; directionZ[i] = ray.direction.z;
+		inverseDirectionX[i] = 1.0f / ray.direction.x; inverseDirectionY[i] = 1.0f / ray.direction.y; inverseDirectionZ[i] = 1.0f / ray.direction.z;
+	}
+	Ray GetRay(int i) const { return Ray({ posX[i], posY[i], posZ[i] }, { directionX[i], directionY[i], directionZ[i] }); }
+
+	alignas(16) float posX[RAY_PACKET_SIZE], posY[RAY_PACKET_SIZE], posZ[RAY_PACKET_SIZE];
+	alignas(16) float directionX[RAY_PACKET_SIZE], directionY[RAY_PACKET_SIZE], directionZ[RAY_PACKET_SIZE];
+	alignas(16) float inverseDirectionX[RAY_PACKET_SIZE], inverseDirectionY[RAY_PACKET_SIZE], inverseDirectionZ[RAY_PACKET_SIZE];
+};
+
 struct Object;
 struct HitInfo {
 	glm::vec3 point;
@@ -55,6 +92,7 @@ struct HitInfo {
 	Object* object = nullptr;
 	float distance = std::numeric_limits<float>::max();
 	glm::vec2 uv;
+	uint32_t primitiveIndex = 0; // Which part of the object was hit, for objects made of many primitives
 };
 
 struct ColorTexture;
@@ -65,6 +103,8 @@ struct Texture {
 	virtual ~Texture() {}
 	virtual glm::vec3 GetColorValue(const glm::vec2& uv, const glm::vec3& p) const = 0;
 	virtual bool IsSolidInPosition(const glm::vec2& uv, const glm::vec3& p) const { return true; }
+	// Return: Can IsSolidInPosition be false anywhere
+	virtual bool HasHoles() const { return false; }
 
 	static std::shared_ptr<UVTexture> CreateUV() { return std::make_shared<UVTexture>(); }
 	static std::shared_ptr<ColorTexture> CreateColored(const glm::vec3& col) { return std::make_shared<ColorTexture>(col); }
@@ -78,11 +118,15 @@ struct ImageTexture : public Texture {
 
 	glm::vec3 GetColorValue(const glm::vec2& uv, const glm::vec3& p) const override;
 	bool IsSolidInPosition(const glm::vec2& uv, const glm::vec3& p) const override;
+	bool HasHoles() const override { return hasHoles; }
 
 	inline int GetIndexFromUV(const glm::vec2& uv) const { return 4 * (int)((int)(uv.y * size.y) * size.x + (int)(uv.x * size.x)); }
 
 	glm::uvec2 size;
 	char* imageData;
+	bool hasHoles = false; // Some pixel is clear enough to be cut out
+
+	static constexpr float CLIP_VALUE = 0.01f;
 };
 struct ColorTexture : public Texture {
 	ColorTexture() = default;
@@ -126,6 +170,10 @@ struct BoundingBox {
 	BoundingBox() = default;
 	BoundingBox(glm::vec3 minCoord, glm::vec3 maxCoord) : minCoord(minCoord), maxCoord(maxCoord) {}
 	bool DoesRayHit(const Ray& ray) const;
+	// Return: Does the ray hit. The distances can be negative if the box is behind or around the ray origin
+	bool GetRayHitDistances(const Ray& ray, float& outTMin, float& outTMax) const;
+	// Return: A bit for every ray of the packet that enters the box before its max distance
+	uint32_t GetPacketHitMask(const RayPacket& packet, const float* maxDistances) const;
 	glm::vec3 CalculatePivot() const { return glm::lerp(minCoord, maxCoord, 0.5f); };
 
 	glm::vec3 minCoord{ 0 };
@@ -138,9 +186,9 @@ struct Camera {
 	Camera() : pos({ 0, 0, 0 }) { SetForwardVector({ 1, 0, 0 }); }
 
 	void SetForwardVector(const glm::vec3& lookVector);
-	const glm::vec3& GetForwardVector() { return forwardVector; };
-	const glm::vec3& GetUDirection() { return uVec; }
-	const glm::vec3& GetVDirection() { return vVec; }
+	const glm::vec3& GetForwardVector() const { return forwardVector; };
+	const glm::vec3& GetUDirection() const { return uVec; }
+	const glm::vec3& GetVDirection() const { return vVec; }
 
 	glm::vec3 pos;
 
@@ -149,15 +197,51 @@ private:
 	glm::vec3 uVec;
 	glm::vec3 vVec;
 
-	// Normalized camera up direction
-	const glm::vec3 globalCameraUpVector = { 0, 1, 0 };
+	// Normalized camera up direction. Static, so cameras can be copied to the render threads
+	inline static const glm::vec3 globalCameraUpVector = { 0, 1, 0 };
+
 };
+
+// Picks an index in proportion to its weight with one lookup, by Walker and Vose
+struct AliasTable {
+	// Return: Was there any weight
+	bool Build(const std::vector<float>& weights);
+	// Takes a number from 0 to 1 and leaves a new one from 0 to 1 in it, so the same sample can also place the point inside the bin
+	uint32_t Sample(float& sample) const;
+	float GetProbability(uint32_t index) const { return probabilities[index]; }
+	bool IsEmpty() const { return entries.empty(); }
+
+private:
+	struct Entry {
+		float threshold; // Below this the bin itself, above it the alias
+		uint32_t alias;
+	};
+	std::vector<Entry> entries;
+	std::vector<float> probabilities;
+};
+
+// The image is a cylindrical equal-area projection: x is the angle around the y axis, y is the height of the direction.
+// Every pixel covers the same solid angle, so a pixel's chance in the distribution is also its share of the pdf.
 struct Skybox {
 	Skybox(const std::string& filepath);
 	~Skybox();
 
+	glm::vec3 GetPixel(const glm::vec3& direction) const;
+	inline glm::vec3 GetPixel(int x, int y) const;
+
+	// Return: A direction picked in proportion to the brightness of the pixels
+	glm::vec3 SampleDirection(glm::vec2 sample, float& outPdf) const;
+	// Return: The pdf of SampleDirection giving the direction, per solid angle
+	float GetPdf(const glm::vec3& direction) const;
+	bool CanBeSampled() const { return !distribution.IsEmpty(); }
+
 	glm::uvec2 size;
 	char* skyboxImageData = nullptr;
+
+private:
+	inline uint32_t GetPixelIndex(const glm::vec3& direction) const;
+
+	AliasTable distribution; // Of the pixels by luminance, built once when loaded
 };
 
 
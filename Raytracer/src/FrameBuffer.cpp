@@ -0,0 +1,151 @@
+#include "FrameBuffer.h"
+#include "World.h"
+#include <glm.hpp>
+#include <algorithm>
+
+FrameBuffer::FrameBuffer() {
+	for (std::atomic<uint32_t>& sequence : tileSequences)
+		sequence.store(0, std::memory_order_relaxed);
+	tileGenerations.fill(0);
+	for (uint32_t tile = 0; tile < TILE_COUNT; tile++) {
+		tileSampleCounts[tile].store(0, std::memory_order_relaxed);
+		tileFrames[tile].store(0, std::memory_order_relaxed);
+		tileConverged[tile].store(false, std::memory_order_relaxed);
+	}
+	for (uint32_t& sequence : snapshotSequences)
+		sequence = 1; // Never equal to a real sequence, so the first snapshot copies everything
+
+	Clear();
+}
+
+void FrameBuffer::Clear() {
+	for (std::atomic<uint32_t>& pixel : pixels)
+		pixel.store(0, std::memory_order_relaxed);
+
+	// Marks every tile as changed
+	for (std::atomic<uint32_t>& sequence : tileSequences)
+		sequence.fetch_add(2, std::memory_order_release);
+}
+
+uint32_t FrameBuffer::LockTile(uint32_t tile) {
+	// An abandoned frame can still be writing the tile, so making the sequence odd also locks the tile
+	std::atomic<uint32_t>& sequence = tileSequences[tile];
+	uint32_t start;
+	do {
+		start = sequence.load(std::memory_order_relaxed) & ~1u;
+	} while (!sequence.compare_exchange_weak(start, start + 1, std::memory_order_acquire, std::memory_order_relaxed));
+	std::atomic_thread_fence(std::memory_order_release);
+	return start;
+}
+
+bool FrameBuffer::WriteTile(uint32_t tile, const uint32_t* tilePixels, uint32_t generation) {
+	const uint32_t tileX = (tile % TILE_COUNT_X) * TILE_SIZE;
+	const uint32_t tileY = (tile / TILE_COUNT_X) * TILE_SIZE;
+	const uint32_t width = glm::min((uint32_t)TILE_SIZE, WINDOW_WIDTH - tileX);
+	const uint32_t height = glm::min((uint32_t)TILE_SIZE, WINDOW_HEIGHT - tileY);
+
+	std::atomic<uint32_t>& sequence = tileSequences[tile];
+	const uint32_t start = LockTile(tile);
+	if ((int32_t)(generation - tileGenerations[tile]) < 0) {
+		sequence.store(start, std::memory_order_release);
+		return false;
+	}
+	tileGenerations[tile] = generation;
+
+	for (uint32_t y = 0; y < height; y++) {
+		for (uint32_t x = 0; x < width; x++)
+			pixels[(tileY + y) * WINDOW_WIDTH + tileX + x].store(tilePixels[y * TILE_SIZE + x], std::memory_order_relaxed);
+	}
+
+	sequence.store(start + 2, std::memory_order_release);
+	return true;
+}
+
+// Return: The biggest difference of the red, green and blue of two packed colors
+static inline uint32_t GetColorDifference(uint32_t a, uint32_t b) {
+	uint32_t difference = 0;
+	for (int shift = 8; shift < 32; shift += 8)
+		difference = glm::max(difference, (uint32_t)glm::abs((int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF)));
+	return difference;
+}
+
+bool FrameBuffer::AccumulateTile(uint32_t tile, const glm::vec3* tileColorSums, uint32_t sampleCount, uint32_t frame, uint32_t generation, bool& outConverged) {
+	const uint32_t tileX = (tile % TILE_COUNT_X) * TILE_SIZE;
+	const uint32_t tileY = (tile / TILE_COUNT_X) * TILE_SIZE;
+	const uint32_t width = glm::min((uint32_t)TILE_SIZE, WINDOW_WIDTH - tileX);
+	const uint32_t height = glm::min((uint32_t)TILE_SIZE, WINDOW_HEIGHT - tileY);
+	outConverged = false;
+
+	std::atomic<uint32_t>& sequence = tileSequences[tile];
+	const uint32_t start = LockTile(tile);
+	if ((int32_t)(generation - tileGenerations[tile]) < 0) {
+		sequence.store(start, std::memory_order_release);
+		return false;
+	}
+	tileGenerations[tile] = generation;
+
+	const uint32_t oldCount = GetTileSampleCount(tile, frame);
+	const uint32_t newCount = oldCount + sampleCount;
+	uint32_t biggestChange = 0;
+	for (uint32_t y = 0; y < height; y++) {
+		for (uint32_t x = 0; x < width; x++) {
+			const uint32_t index = (tileY + y) * WINDOW_WIDTH + tileX + x;
+			colorSums[index] = (oldCount == 0 ? glm::vec3{ 0 } : colorSums[index]) + tileColorSums[y * TILE_SIZE + x];
+
+			const uint32_t color = PackColor(World::ToDisplayColor(colorSums[index] / (float)newCount));
+			biggestChange = glm::max(biggestChange, GetColorDifference(color, pixels[index].load(std::memory_order_relaxed)));
+			pixels[index].store(color, std::memory_order_relaxed);
+		}
+	}
+
+	// The first samples replace whatever was shown, so they can't tell anything yet
+	outConverged = oldCount > 0 && biggestChange <= REFINEMENT_TOLERANCE;
+	tileFrames[tile].store(frame, std::memory_order_relaxed);
+	tileSampleCounts[tile].store(newCount, std::memory_order_relaxed);
+	tileConverged[tile].store(outConverged, std::memory_order_relaxed);
+
+	sequence.store(start + 2, std::memory_order_release);
+	return true;
+}
+
+uint32_t FrameBuffer::GetTileSampleCount(uint32_t tile, uint32_t frame) const {
+	return tileFrames[tile].load(std::memory_order_relaxed) == frame ? tileSampleCounts[tile].load(std::memory_order_relaxed) : 0;
+}
+bool FrameBuffer::IsTileConverged(uint32_t tile, uint32_t frame) const {
+	return tileFrames[tile].load(std::memory_order_relaxed) == frame && tileConverged[tile].load(std::memory_order_relaxed);
+}
+
+void FrameBuffer::Snapshot(uint32_t* outPixels) {
+	const int maxAttempts = 4;
+	std::array<uint32_t, TILE_SIZE * TILE_SIZE> tilePixels;
+
+	for (uint32_t tile = 0; tile < TILE_COUNT; tile++) {
+		const uint32_t tileX = (tile % TILE_COUNT_X) * TILE_SIZE;
+		const uint32_t tileY = (tile / TILE_COUNT_X) * TILE_SIZE;
+		const uint32_t width = glm::min((uint32_t)TILE_SIZE, WINDOW_WIDTH - tileX);
+		const uint32_t height = glm::min((uint32_t)TILE_SIZE, WINDOW_HEIGHT - tileY);
+
+		// If a tile keeps getting written, the old copy is shown for one more present
+		for (int attempt = 0; attempt < maxAttempts; attempt++) {
+			uint32_t before = tileSequences[tile].load(std::memory_order_acquire);
+			if (before == snapshotSequences[tile])
+				break;
+			if (before & 1)
+				continue;
+
+			// A torn copy stays in the scratch tile, only a whole one goes out
+			for (uint32_t y = 0; y < height; y++) {
+				for (uint32_t x = 0; x < width; x++)
+					tilePixels[y * TILE_SIZE + x] = pixels[(tileY + y) * WINDOW_WIDTH + tileX + x].load(std::memory_order_relaxed);
+			}
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (tileSequences[tile].load(std::memory_order_relaxed) == before) {
+				for (uint32_t y = 0; y < height; y++)
+					std::copy_n(&tilePixels[y * TILE_SIZE], width, &outPixels[(tileY + y) * WINDOW_WIDTH + tileX]);
+				snapshotSequences[tile] = before;
+				break;
+			}
+		}
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "Constants.h"
+
+#include <glm.hpp>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+constexpr uint32_t TILE_COUNT_X = (WINDOW_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+constexpr uint32_t TILE_COUNT_Y = (WINDOW_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+constexpr uint32_t TILE_COUNT = TILE_COUNT_X * TILE_COUNT_Y;
+
+// Pixels that the render threads write into while the UI thread copies them out, without
+// either one waiting for the other. Every tile has a sequence number that is odd while the tile is
+// being written, so a copy can tell if it overlapped a write and try again.
+// Tiles remember the frame generation that wrote them, so a late write from an abandoned frame can't overwrite a newer one.
+// Pixels are RGBA8888, the format of the SDL texture. Full resolution samples are also summed as floats, so the passes
+// of a frame add up to a running mean that keeps getting better while the camera stays still.
+class FrameBuffer {
+public:
+	FrameBuffer();
+
+	// Only when no thread is writing
+	void Clear();
+
+	// Pixels are given in row order of the tile, TILE_SIZE per row. Return: False if a newer frame already wrote the tile
+	bool WriteTile(uint32_t tile, const uint32_t* tilePixels, uint32_t generation);
+	// Adds sampleCount samples of every pixel to their running means, and shows the means. The sums are in the same order as in WriteTile.
+	// A new frame starts the means over. outConverged tells if the samples changed no pixel by more than REFINEMENT_TOLERANCE.
+	// Return: False if a newer frame already wrote the tile
+	bool AccumulateTile(uint32_t tile, const glm::vec3* tileColorSums, uint32_t sampleCount, uint32_t frame, uint32_t generation, bool& outConverged);
+	// Return: Samples in the means of the tile's pixels, 0 if they are of another frame. All pixels of a tile always get the same samples
+	uint32_t GetTileSampleCount(uint32_t tile, uint32_t frame) const;
+	bool IsTileConverged(uint32_t tile, uint32_t frame) const;
+
+	// Copies the tiles that have changed since the last snapshot into outPixels. Only one thread can take snapshots.
+	void Snapshot(uint32_t* outPixels);
+
+	static uint32_t PackColor(glm::u8vec3 color) { return ((uint32_t)color.r << 24) | ((uint32_t)color.g << 16) | ((uint32_t)color.b << 8) | 255; }
+
+private:
+	// Makes the tile's sequence odd, which also waits for other writes to it. Return: The sequence before, to store back plus 2 when done
+	uint32_t LockTile(uint32_t tile);
+
+	// Relaxed atomics compile to plain moves, but make the overlapping reads well defined
+	std::array<std::atomic<uint32_t>, WINDOW_WIDTH * WINDOW_HEIGHT> pixels;
+	std::array<std::atomic<uint32_t>, TILE_COUNT> tileSequences;
+	std::array<uint32_t, TILE_COUNT> tileGenerations; // Only accessed while the tile's sequence is odd
+	std::array<uint32_t, TILE_COUNT> snapshotSequences; // Sequence of each tile at the last snapshot
+
+	std::array<glm::vec3, WINDOW_WIDTH * WINDOW_HEIGHT> colorSums; // Only accessed while the tile's sequence is odd
+	// Only changed while the sequence is odd, atomic so the render threads can read them before writing
+	std::array<std::atomic<uint32_t>, TILE_COUNT> tileSampleCounts;
+	std::array<std::atomic<uint32_t>, TILE_COUNT> tileFrames; // Frame the sums are of
+	std::array<std::atomic<bool>, TILE_COUNT> tileConverged;
+};
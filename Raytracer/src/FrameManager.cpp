@@ -1,122 +1,657 @@
 #include "FrameManager.h"
 #include "Constants.h"
+#include "Platform.h"
 #include <chrono>
 #include <sstream>
 #include <cstring>
+#include <algorithm>
+#include <new>
 
-void FrameManager::StartNewFrame() {
+FrameManager::FrameManager() 
+	: skybox(std::make_shared<Skybox>(std::string("src/stb_image/skybox12.png"))),
+	  currentWorld(new World(skybox, 0.0f))
+{
+	for (uint32_t i = 0; i < TILE_SIZE * TILE_SIZE; i++) {
+		glm::u8vec2 pos{ 0 };
+		for (uint32_t bit = 0; (1u << (2 * bit)) < TILE_SIZE * TILE_SIZE; bit++) {
+			pos.x |= ((i >> (2 * bit)) & 1) << bit;
+			pos.y |= ((i >> (2 * bit + 1)) & 1) << bit;
+		}
+		tilePixelOrder[i] = pos;
+	}
+
+	UpdateTileOrder();
+
+	const uint32_t coreCount = Platform::GetLogicalCoreCount();
+	threadCount = THREAD_COUNT > 0 ? THREAD_COUNT : (uint32_t)std::max((int)coreCount - THREAD_RESERVE, 1);
+
+	// Every thread counts as working until it has created its own data
+	threadData.resize(threadCount, nullptr);
+	workingThreadAmount = threadCount;
+	threads.reserve(threadCount);
+	for (uint32_t i = 0; i < threadCount; i++)
+		threads.push_back(std::thread(&FrameManager::ThreadWork, this, i));
+	WaitForThreadsToStop();
+
+	// A thread that couldn't get memory on its own node gets it from anywhere. Without it the renderer can't start.
+	for (uint32_t i = 0; i < threadCount; i++) {
+		if (threadData[i] == nullptr && !CreateThreadData(i, Platform::ANY_NUMA_NODE)) {
+			TerminateAllThreads();
+			throw std::bad_alloc();
+		}
+	}
+	worldBuilder = std::thread(&FrameManager::WorldBuilderWork, this);
+
+#if LOG_BENCHMARK
+	std::cout << "Render threads: " << threadCount << ", logical cores: " << coreCount << (PIN_THREADS_TO_CORES ? ", pinned" : "") << std::endl;
+#endif
+}
+FrameManager::~FrameManager() {
 	TerminateAllThreads();
+}
 
-	time += 1.0f;
-	world.CreateWithNewTime(time);
+void FrameManager::StartNewFrame(const Camera& camera) {
+#if LOG_BENCHMARK
+	firstTileLogged = false;
+	presentDuration = presentDuration.zero();
+	presentAmount = 0;
+#endif
 
-	memset(&texturePixels, 0, texturePixels.size());
-	threadState = ThreadState::Work;
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		auto now = std::chrono::steady_clock::now();
+#if DYNAMIC_RESOLUTION
+		UpdateRenderScale(now);
+#endif
+		frameRequestTime = now;
+		frameSettings.camera = camera;
+		frameSettings.frameIndex++;
+		frameSettings.renderScale = renderScale;
+		frameSettings.previewSamplesPerAxis = previewSamplesPerAxis;
+		if (frameSettings.pointOfInterest != pointOfInterest) {
+			frameSettings.pointOfInterest = pointOfInterest;
+			UpdateTileOrder();
+		}
+		isStillFrame = false;
+		previewDuration = -1;
+		threadState = ThreadState::Work;
+		StartPass(0);
+	}
+	stateChanged.notify_all();
+}
+void FrameManager::FinishPass(uint32_t generation) {
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
 
-	try {
-		threads.reserve(THREAD_COUNT);
-		for (uint32_t i = 0; i < THREAD_COUNT; i++) {
-			runningThreadAmount++;
-			threads.push_back(std::thread(&FrameManager::ThreadWork, this, i));
+		// The camera moved while the pass was finishing
+		if (frameGeneration != generation)
+			return;
+
+		if (framePass + 1 == QUALITY_PASS)
+			previewDuration = std::chrono::duration<float>(std::chrono::steady_clock::now() - frameRequestTime).count();
+
+		// The preview passes follow each other right away
+		if (framePass + 1 >= QUALITY_PASS)
+			return;
+		StartPass(framePass + 1);
+	}
+	stateChanged.notify_all();
+}
+void FrameManager::StartQualityPass(uint32_t generation) {
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		if (frameGeneration != generation)
+			return;
+
+		if (frameSettings.renderScale < 1.0f) {
+			// Calculate the previews again at full resolution, starting from the one that has about the current resolution
+			int skippedPasses = glm::min((int)glm::round(glm::log2(1.0f / frameSettings.renderScale)), (int)QUALITY_PASS - 1);
+			frameSettings.renderScale = 1.0f;
+			isStillFrame = true;
+			StartPass(QUALITY_PASS - 1 - skippedPasses);
 		}
+		else
+			StartPass(QUALITY_PASS);
+	}
+	stateChanged.notify_all();
+}
+void FrameManager::StartRefinementPass(uint32_t generation) {
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		if (frameGeneration != generation)
+			return;
+		StartPass(framePass + 1);
+	}
+	stateChanged.notify_all();
+}
+void FrameManager::StartPass(uint32_t pass) {
+#if LOG_BENCHMARK
+	auto now = std::chrono::steady_clock::now();
+	if (frameGeneration > 0 && (uint32_t)frameProgress == 0) {
+		std::chrono::duration<double, std::milli> passDuration = now - passStartTime;
+		std::cout << "Pass " << framePass << " calculating time: " << passDuration.count() << "ms" << std::endl;
 	}
-	catch (...) {
-		throw;
+	passStartTime = now;
+#endif
+
+	// The threads keep working on the old generation until they see the new one
+	const uint32_t generation = frameGeneration + 1;
+	frameProgress = ((uint64_t)generation << 32) | TILE_COUNT;
+	unconvergedTileAmount = 0;
+	DistributeTiles(generation);
+	framePass = pass;
+	frameGeneration = generation;
+}
+
+void FrameManager::UpdateRenderScale(std::chrono::steady_clock::time_point now) {
+	if (QUALITY_PASS == 0 || frameGeneration == 0 || isStillFrame)
+		return;
+
+	// How long the previous frame's previews took, or would have taken if the camera hadn't moved
+	float duration = previewDuration;
+	if (duration < 0) {
+		float progress = GetPreviewProgress();
+		if (progress <= 0.0f)
+			return;
+		duration = std::chrono::duration<float>(now - frameRequestTime).count() / progress;
 	}
 
+	float cost = 0;
+	for (uint32_t pass = 0; pass < QUALITY_PASS; pass++)
+		cost += GetPassCost(pass, frameSettings);
+	float measurement = duration / cost;
+	secondsPerPreviewCost = secondsPerPreviewCost == 0 ? measurement : glm::mix(secondsPerPreviewCost, measurement, 0.25f);
+
+	// First add samples to the last preview, after that lower the resolution
+	FrameSettings fullResolution = frameSettings;
+	fullResolution.renderScale = 1.0f;
+	fullResolution.previewSamplesPerAxis = 0;
+	float coarsePassCost = 0;
+	for (uint32_t pass = 0; pass < QUALITY_PASS; pass++)
+		coarsePassCost += GetPassCost(pass, fullResolution);
+
+	const float affordableCost = RENDER_TIME_BUDGET / FPS / secondsPerPreviewCost;
+	const int oldSamples = previewSamplesPerAxis;
+	const float oldScale = renderScale;
+	previewSamplesPerAxis = glm::clamp((int)glm::sqrt(glm::max(affordableCost - coarsePassCost, 0.0f)), 1, SAMPLES_PER_PIXEL_AXIS);
+	float scale = glm::sqrt(affordableCost / (coarsePassCost + 1.0f));
+
+	// Steps of 1/16, so small changes in the measurement don't change the resolution
+	renderScale = glm::clamp(glm::floor(scale * 16.0f) / 16.0f, MIN_RENDER_SCALE, 1.0f);
+
 #if LOG_BENCHMARK
-	frameStartTime = std::chrono::system_clock::now();
+	if (oldSamples != previewSamplesPerAxis || oldScale != renderScale)
+		std::cout << "Render scale: " << renderScale << ", preview samples per axis: " << previewSamplesPerAxis << std::endl;
 #endif
 }
+float FrameManager::GetPreviewProgress() const {
+	float done = 0, total = 0;
+	for (uint32_t pass = 0; pass < QUALITY_PASS; pass++) {
+		float passCost = GetPassCost(pass, frameSettings);
+		total += passCost;
+		if (pass < framePass)
+			done += passCost;
+		else if (pass == framePass)
+			done += passCost * (1.0f - (float)(uint32_t)frameProgress / TILE_COUNT);
+	}
+	return done / total;
+}
+float FrameManager::GetPassCost(uint32_t pass, const FrameSettings& settings) {
+	if (pass >= QUALITY_PASS)
+		return (float)(SAMPLES_PER_PIXEL_AXIS * SAMPLES_PER_PIXEL_AXIS);
+
+	const float blockSize = (float)(1u << (PREVIEW_PASS_COUNT - 1 - pass));
+	const float samples = pass + 1 == QUALITY_PASS ? (float)(settings.previewSamplesPerAxis * settings.previewSamplesPerAxis) : 1.0f;
+	return settings.renderScale * settings.renderScale * samples / (blockSize * blockSize);
+}
+
+void FrameManager::AdvanceWorldTime() {
+	{
+		std::lock_guard<std::mutex> lock(worldMutex);
+		requestedTime += 1.0f;
+	}
+	worldUpdateRequested.notify_one();
+}
+void FrameManager::WorldBuilderWork() {
+	float builtTime = requestedTime;
+
+	while (true) {
+		float time;
+		{
+			// Old worlds are checked again every millisecond until they can be deleted
+			std::unique_lock<std::mutex> lock(worldMutex);
+			auto isRequested = [&] { return quitWorldBuilder || requestedTime != builtTime; };
+			if (retiredWorlds.empty())
+				worldUpdateRequested.wait(lock, isRequested);
+			else
+				worldUpdateRequested.wait_for(lock, std::chrono::milliseconds(1), isRequested);
+
+			if (quitWorldBuilder)
+				return;
+			time = requestedTime;
+		}
+
+		// Requests that came in while building are skipped, only the newest time gets built
+		if (time != builtTime) {
+#if LOG_BENCHMARK
+			auto buildStartTime = std::chrono::steady_clock::now();
+#endif
+			World* oldWorld = currentWorld.exchange(new World(skybox, time));
+			retiredWorlds.push_back({ oldWorld, worldEpoch.fetch_add(1) });
+			builtTime = time;
+			worldChanged = true;
+
+#if LOG_BENCHMARK
+			std::chrono::duration<double, std::milli> buildDuration = std::chrono::steady_clock::now() - buildStartTime;
+			std::cout << "World build time: " << buildDuration.count() << "ms" << std::endl;
+#endif
+		}
+
+		ReclaimWorlds();
+	}
+}
+void FrameManager::ReclaimWorlds() {
+	uint64_t oldestUsedEpoch = IDLE_EPOCH;
+	for (const RenderThreadData* data : threadData)
+		oldestUsedEpoch = std::min(oldestUsedEpoch, data->worldEpoch.load());
+
+	// Threads that started after the swap got the new world
+	for (size_t i = 0; i < retiredWorlds.size(); i++) {
+		if (retiredWorlds[i].second < oldestUsedEpoch) {
+			delete retiredWorlds[i].first;
+			retiredWorlds[i] = retiredWorlds.back();
+			retiredWorlds.pop_back();
+			i--;
+		}
+	}
+}
+void FrameManager::DistributeTiles(uint32_t generation) {
+	stolenTileAmount = 0;
+
+	// Tiles left over from an abandoned frame are thrown away
+	for (RenderThreadData* data : threadData) {
+		std::lock_guard<std::mutex> lock(data->tileQueue.mutex);
+		data->tileQueue.generation = generation;
+		data->tileQueue.front = 0;
+		data->tileQueue.back = 0;
+		data->calculatedTileAmount = 0;
+	}
+
+	for (uint32_t i = 0; i < TILE_COUNT; i++) {
+#if FOVEATED_RENDERING
+		// Every thread starts from its tile closest to the point of interest
+		TileQueue& queue = threadData[i % threadCount]->tileQueue;
+#else
+		// Each thread gets a part of the order
+		TileQueue& queue = threadData[(i * threadCount) / TILE_COUNT]->tileQueue;
+#endif
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tiles[queue.back++] = tileOrder[i];
+	}
+}
+void FrameManager::UpdateTileOrder() {
+#if FOVEATED_RENDERING
+	for (uint32_t tile = 0; tile < TILE_COUNT; tile++)
+		tileOrder[tile] = tile;
+	const glm::vec2 pointOfInterest = frameSettings.pointOfInterest;
+	std::sort(tileOrder.begin(), tileOrder.end(), [pointOfInterest](uint32_t a, uint32_t b) {
+		return GetFoveaDistance(a, pointOfInterest) < GetFoveaDistance(b, pointOfInterest);
+	});
+#else
+	// Spread the tiles, so the whole image starts appearing at once
+	uint32_t orderIndex = 0;
+	for (uint32_t offset = 0; offset < TILE_CALCULATING_ORDER_SPREAD; offset++) {
+		for (uint32_t tile = offset; tile < TILE_COUNT; tile += TILE_CALCULATING_ORDER_SPREAD)
+			tileOrder[orderIndex++] = tile;
+	}
+#endif
+}
+float FrameManager::GetFoveaDistance(uint32_t tile, glm::vec2 pointOfInterest) {
+	glm::vec2 tileCenter = glm::vec2(tile % TILE_COUNT_X, tile / TILE_COUNT_X) * (float)TILE_SIZE + TILE_SIZE * 0.5f;
+	return glm::length(tileCenter - pointOfInterest) / (WINDOW_HEIGHT * FOVEA_RADIUS);
+}
+
 void FrameManager::TerminateAllThreads() {
-	threadState = ThreadState::Quit;
-	while (runningThreadAmount != 0)
-		std::this_thread::sleep_for(std::chrono::microseconds(5));
+	SetThreadState(ThreadState::Quit);
 	for (int i = 0; i < threads.size(); i++)
 		threads[i].join();
 	threads.clear();
+
+	if (worldBuilder.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(worldMutex);
+			quitWorldBuilder = true;
+		}
+		worldUpdateRequested.notify_one();
+		worldBuilder.join();
+	}
+
+	// No thread is left to use the worlds
+	for (auto& [world, epoch] : retiredWorlds)
+		delete world;
+	retiredWorlds.clear();
+	delete currentWorld.exchange(nullptr);
+
+	for (RenderThreadData*& data : threadData) {
+		if (data == nullptr)
+			continue;
+		data->~RenderThreadData();
+		Platform::FreeNumaAllocation(data, sizeof(RenderThreadData));
+		data = nullptr;
+	}
+}
+
+void FrameManager::SetThreadState(ThreadState state) {
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		threadState = state;
+	}
+	stateChanged.notify_all();
+}
+
+void FrameManager::WaitForThreadsToStop() {
+	std::unique_lock<std::mutex> lock(stateMutex);
+	threadsStopped.wait(lock, [this] { return workingThreadAmount == 0; });
+}
+
+void FrameManager::StopWorking() {
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		workingThreadAmount--;
+	}
+	threadsStopped.notify_one();
 }
 
 bool FrameManager::NeedUpdatingTexture() {
 	if (threadState == ThreadState::AllComplete)
 		return false;
 
-	if (runningThreadAmount == 0)
-		FinishFrame();
+	uint64_t progress = frameProgress;
+	if ((uint32_t)progress == 0) {
+		// The previews can already have all samples. Foveated previews leave the periphery coarse, so they need the quality pass.
+		bool previewsHaveFullQuality = !(FOVEATED_RENDERING && QUALITY_PASS > 1) && !DETERMINISTIC_RENDERING && frameSettings.renderScale == 1.0f && frameSettings.previewSamplesPerAxis >= SAMPLES_PER_PIXEL_AXIS;
+
+		if (framePass >= QUALITY_PASS || (framePass == QUALITY_PASS - 1 && previewsHaveFullQuality)) {
+			// The passes add up, so a still camera keeps getting a better image until it stops changing
+#if DETERMINISTIC_RENDERING
+			// The same number of passes on any machine
+			const bool canRefine = framePass < QUALITY_PASS + DETERMINISTIC_REFINEMENT_PASSES;
+#else
+			const float stillDuration = std::chrono::duration<float>(std::chrono::steady_clock::now() - frameRequestTime).count();
+			const bool canRefine = stillDuration < REFINEMENT_TIME_LIMIT;
+#endif
+			if (PROGRESSIVE_REFINEMENT && unconvergedTileAmount > 0 && canRefine)
+				StartRefinementPass((uint32_t)(progress >> 32));
+			else
+				FinishFrame();
+		}
+		// Full quality only once the camera has stayed still for a moment
+		else if (framePass == QUALITY_PASS - 1 && std::chrono::steady_clock::now() - frameRequestTime >= std::chrono::duration<float>(FULL_QUALITY_DELAY))
+			StartQualityPass((uint32_t)(progress >> 32));
+	}
 
 	return true;
 }
 
 void FrameManager::FinishFrame() {
-	threadState = ThreadState::AllComplete;
+	SetThreadState(ThreadState::AllComplete);
 
 #if LOG_BENCHMARK
-	auto endTime = std::chrono::system_clock::now();
-	std::chrono::duration<double> dur = endTime - frameStartTime;
-	std::cout << "Frame calculating time: " << dur.count() << std::endl;
+	std::chrono::duration<double> dur = std::chrono::steady_clock::now() - passStartTime;
+	std::cout << "Frame calculating time: " << dur.count() << ", stolen tiles: " << stolenTileAmount;
+
+	// Compare these between thread counts to see how well the rendering scales
+	uint32_t leastTiles = TILE_COUNT, mostTiles = 0;
+	for (const RenderThreadData* data : threadData) {
+		leastTiles = std::min(leastTiles, data->calculatedTileAmount.load());
+		mostTiles = std::max(mostTiles, data->calculatedTileAmount.load());
+	}
+	double megapixelsPerSecond = (double)WINDOW_WIDTH * WINDOW_HEIGHT / dur.count() / 1000000.0;
+	std::cout << ", Mpixels/s: " << megapixelsPerSecond << " (" << megapixelsPerSecond / threadCount << " per thread)";
+	std::cout << ", tiles per thread: " << leastTiles << "-" << mostTiles;
+	if (presentAmount > 0)
+		std::cout << ", average present copy: " << presentDuration.count() / presentAmount << "us";
+	std::cout << std::endl;
 #endif
 }
 
 void* FrameManager::GetTexturePixelsToPresent() {
-	if (threadState == ThreadState::AllComplete)
-		return texturePixels.data();
+#if LOG_BENCHMARK
+	auto presentStartTime = std::chrono::steady_clock::now();
+#endif
 
-	// Wait for all the threads to stop calculating
-	threadState = ThreadState::Sleep;
-	while (workingThreadAmount != 0) {
-		std::this_thread::sleep_for(std::chrono::microseconds(5));
-	}
+	frameBuffer.Snapshot(presentPixels.data());
 
-	return texturePixels.data();
+#if LOG_BENCHMARK
+	presentDuration += std::chrono::steady_clock::now() - presentStartTime;
+	presentAmount++;
+#endif
+	return presentPixels.data();
 }
 
-void FrameManager::ContinueWorkingOnImage() {
-	if (threadState != ThreadState::AllComplete)
-		threadState = ThreadState::Work;
+bool FrameManager::CreateThreadData(uint32_t threadIndex, uint32_t numaNode) {
+	void* memory = Platform::AllocateOnNumaNode(sizeof(RenderThreadData), numaNode);
+	if (memory == nullptr)
+		return false;
+
+	try {
+		threadData[threadIndex] = new (memory) RenderThreadData();
+	}
+	catch (const std::bad_alloc&) {
+		Platform::FreeNumaAllocation(memory, sizeof(RenderThreadData));
+		return false;
+	}
+	return true;
 }
 
 void FrameManager::ThreadWork(uint32_t threadIndex) {
-	workingThreadAmount++;
-	const uint32_t pixelAmount = (uint32_t)texturePixels.size() / 4;
-	const uint32_t startIndex = (threadIndex * pixelAmount) / THREAD_COUNT * 4;
-	const uint32_t endIndex = ((threadIndex+1) * pixelAmount) / THREAD_COUNT * 4;
+	uint32_t calculatedGeneration = 0;
 
-	uint32_t currentPixelIndex = startIndex;
-	uint32_t nextSpreadStartOffset = 1;
+	uint32_t numaNode = Platform::ANY_NUMA_NODE;
+#if PIN_THREADS_TO_CORES
+	// The first cores are left for the UI thread
+	uint32_t core = (threadIndex + THREAD_RESERVE) % Platform::GetLogicalCoreCount();
+	if (Platform::PinCurrentThreadToCore(core))
+		numaNode = Platform::GetNumaNodeOfCore(core);
+#endif
+
+	// The constructor tries again if this fails, the thread can't throw to anyone
+	CreateThreadData(threadIndex, numaNode);
+	StopWorking();
 
 	while (true) {
-		while (threadState == ThreadState::Work) {
-			glm::vec3 col = world.CalculateColorForScreenPosition((currentPixelIndex / 4) % WINDOW_WIDTH, (currentPixelIndex / 4) / WINDOW_WIDTH);
-			int length = (int)texturePixels.size();
-			texturePixels[currentPixelIndex + 0] = 255;
-			texturePixels[currentPixelIndex + 1] = (uint8_t)col.b;
-			texturePixels[currentPixelIndex + 2] = (uint8_t)col.g;
-			texturePixels[currentPixelIndex + 3] = (uint8_t)col.r;
-			currentPixelIndex += 4 * PIXEL_CALCULATING_OREDER_SPREAD;
-
-			if (currentPixelIndex >= endIndex) {
-				currentPixelIndex = startIndex + nextSpreadStartOffset * 4;
-				nextSpreadStartOffset++;
-			}
+		{
+			// Wait for a new frame
+			std::unique_lock<std::mutex> lock(stateMutex);
+			stateChanged.wait(lock, [&] { return threadState == ThreadState::Quit || (threadState == ThreadState::Work && frameGeneration != calculatedGeneration); });
 
-			// Quit if this thread is complete
-			if (nextSpreadStartOffset > PIXEL_CALCULATING_OREDER_SPREAD) {
-				workingThreadAmount--;
-				runningThreadAmount--;
+			if (threadState == ThreadState::Quit)
 				return;
-			}
+
+			workingThreadAmount++;
+			calculatedGeneration = frameGeneration;
+			threadData[threadIndex]->frame = frameSettings;
+			threadData[threadIndex]->pass = framePass;
 		}
 
-		if (threadState == ThreadState::Quit) {
-			workingThreadAmount--;
-			runningThreadAmount--;
-			return;
+		CalculateFrameTiles(threadIndex, calculatedGeneration);
+		StopWorking();
+	}
+}
+
+bool FrameManager::CalculateFrameTiles(uint32_t threadIndex, uint32_t generation) {
+	RenderThreadData& data = *threadData[threadIndex];
+	uint32_t tile;
+	while (GetNextTile(threadIndex, generation, tile)) {
+		// Announce the epoch before getting the world, so the world can't be deleted while the tile is calculated
+		data.worldEpoch = worldEpoch.load();
+		bool isCalculated = CalculateTile(data, *currentWorld.load(), tile, generation);
+		data.worldEpoch = IDLE_EPOCH;
+
+		bool wasLastTile;
+		if (!isCalculated || !CompleteTile(generation, wasLastTile))
+			return false;
+		data.calculatedTileAmount++;
+
+#if LOG_BENCHMARK
+		if (!firstTileLogged.exchange(true)) {
+			std::chrono::duration<double, std::micro> latency = std::chrono::steady_clock::now() - frameRequestTime;
+			std::cout << "First tile latency: " << latency.count() << "us" << std::endl;
 		}
+#endif
 
-		// Wait until thread needs to be used again
-		workingThreadAmount--;
-		while (threadState == ThreadState::Sleep)
-			std::this_thread::sleep_for(std::chrono::microseconds(5));
-		workingThreadAmount++;
+		if (wasLastTile)
+			FinishPass(generation);
 	}
+	return true;
+}
+
+bool FrameManager::CompleteTile(uint32_t generation, bool& outWasLastTile) {
+	uint64_t progress = frameProgress;
+	do {
+		if ((uint32_t)(progress >> 32) != generation)
+			return false;
+	} while (!frameProgress.compare_exchange_weak(progress, progress - 1));
+
+	outWasLastTile = (uint32_t)progress == 1;
+	return true;
+}
+
+bool FrameManager::GetNextTile(uint32_t threadIndex, uint32_t generation, uint32_t& outTile) {
+	{
+		TileQueue& ownQueue = threadData[threadIndex]->tileQueue;
+		std::lock_guard<std::mutex> lock(ownQueue.mutex);
+		if (ownQueue.generation != generation)
+			return false;
+		if (ownQueue.front < ownQueue.back) {
+			outTile = ownQueue.tiles[ownQueue.front++];
+			return true;
+		}
+	}
+
+	for (uint32_t i = 1; i < threadCount; i++) {
+		TileQueue& victim = threadData[(threadIndex + i) % threadCount]->tileQueue;
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (victim.generation == generation && victim.front < victim.back) {
+			outTile = victim.tiles[--victim.back];
+#if LOG_BENCHMARK
+			stolenTileAmount++;
+#endif
+			return true;
+		}
+	}
+	return false;
+}
+
+bool FrameManager::CalculateTile(RenderThreadData& data, World& world, uint32_t tile, uint32_t generation) {
+	const uint32_t tileX = (tile % TILE_COUNT_X) * TILE_SIZE;
+	const uint32_t tileY = (tile / TILE_COUNT_X) * TILE_SIZE;
+
+	const FrameSettings& frame = data.frame;
+	const bool isPreview = data.pass < QUALITY_PASS;
+	if (!isPreview && frameBuffer.IsTileConverged(tile, frame.frameIndex))
+		return true;
+
+	const uint32_t blockSize = isPreview ? 1u << (PREVIEW_PASS_COUNT - 1 - data.pass) : 1;
+	int samplesPerAxis = SAMPLES_PER_PIXEL_AXIS;
+	if (isPreview)
+		samplesPerAxis = data.pass + 1 == QUALITY_PASS ? frame.previewSamplesPerAxis : 1;
+
+#if FOVEATED_RENDERING
+	// The last preview is sharper where the user is looking. The periphery keeps the previous pass until the camera stops.
+	if (isPreview && data.pass + 1 == QUALITY_PASS) {
+		float foveaDistance = GetFoveaDistance(tile, frame.pointOfInterest);
+		if (foveaDistance > 2.0f && data.pass > 0)
+			return true;
+		if (foveaDistance < 1.0f && !DETERMINISTIC_RENDERING)
+			samplesPerAxis = glm::min(samplesPerAxis + 1, SAMPLES_PER_PIXEL_AXIS);
+	}
+#endif
+
+	// Every calculated pixel covers a cell of the window, which is filled with its color
+	const float cellSize = blockSize / frame.renderScale;
+	// The sample count of the previews depends on the speed of the machine, so with DETERMINISTIC_RENDERING only the quality passes add up
+	const bool accumulates = cellSize == 1.0f && !(DETERMINISTIC_RENDERING && isPreview);
+	if (accumulates) {
+		// Full resolution samples of a frame add up over the passes. The sampler continues from the samples the tile already has.
+		const uint32_t sampleCount = samplesPerAxis * samplesPerAxis;
+		const uint32_t firstSample = frameBuffer.GetTileSampleCount(tile, frame.frameIndex);
+#if WAVEFRONT_RENDERING
+		// The whole tile is traced at once, so the frame can only change between tiles
+		if (!IsWorkingOn(generation))
+			return false;
+
+		uint32_t count = 0;
+		for (const glm::u8vec2& offset : tilePixelOrder) {
+			if (tileX + offset.x < WINDOW_WIDTH && tileY + offset.y < WINDOW_HEIGHT)
+				data.screenPositions[count++] = { (float)(tileX + offset.x), (float)(tileY + offset.y) };
+		}
+		data.wavefront.CalculateColors(world, frame.camera, *data.sampler, data.screenPositions.data(), count, samplesPerAxis, frame.frameIndex, firstSample, data.colors.data());
+
+		for (uint32_t i = 0; i < count; i++) {
+			const uint32_t x = (uint32_t)data.screenPositions[i].x - tileX;
+			const uint32_t y = (uint32_t)data.screenPositions[i].y - tileY;
+			data.tileColorSums[y * TILE_SIZE + x] = data.colors[i] * (float)sampleCount;
+		}
+#else
+		for (const glm::u8vec2& offset : tilePixelOrder) {
+			const uint32_t x = tileX + offset.x;
+			const uint32_t y = tileY + offset.y;
+			if (x >= WINDOW_WIDTH || y >= WINDOW_HEIGHT)
+				continue;
+
+			if (!IsWorkingOn(generation))
+				return false;
+
+			data.tileColorSums[offset.y * TILE_SIZE + offset.x] = world.CalculateColorForScreenPosition((float)x, (float)y, frame.camera, *data.sampler, samplesPerAxis, frame.frameIndex, firstSample) * (float)sampleCount;
+		}
+#endif
+
+		bool isConverged;
+		if (!frameBuffer.AccumulateTile(tile, data.tileColorSums.data(), sampleCount, frame.frameIndex, generation, isConverged))
+			return false;
+		if (!isConverged)
+			unconvergedTileAmount++;
+		return true;
+	}
+	else {
+		const uint32_t tileEndX = glm::min(tileX + TILE_SIZE, (uint32_t)WINDOW_WIDTH);
+		const uint32_t tileEndY = glm::min(tileY + TILE_SIZE, (uint32_t)WINDOW_HEIGHT);
+
+		// Pixels belong to the cell they start in. Cells can continue over the tile borders.
+		for (uint32_t cellY = (uint32_t)(tileY / cellSize); ; cellY++) {
+			const uint32_t startY = glm::max((uint32_t)glm::ceil(cellY * cellSize), tileY);
+			const uint32_t endY = glm::min((uint32_t)glm::ceil((cellY + 1) * cellSize), tileEndY);
+			if (startY >= tileEndY)
+				break;
+
+			for (uint32_t cellX = (uint32_t)(tileX / cellSize); ; cellX++) {
+				const uint32_t startX = glm::max((uint32_t)glm::ceil(cellX * cellSize), tileX);
+				const uint32_t endX = glm::min((uint32_t)glm::ceil((cellX + 1) * cellSize), tileEndX);
+				if (startX >= tileEndX)
+					break;
+				if (startY >= endY || startX >= endX)
+					continue;
+
+				if (!IsWorkingOn(generation))
+					return false;
+
+				// Sample from the middle of the cell
+				const float sampleX = glm::min((cellX + 0.5f) * cellSize, (float)(WINDOW_WIDTH - 1));
+				const float sampleY = glm::min((cellY + 0.5f) * cellSize, (float)(WINDOW_HEIGHT - 1));
+				const uint32_t color = FrameBuffer::PackColor(World::ToDisplayColor(world.CalculateColorForScreenPosition(sampleX, sampleY, frame.camera, *data.sampler, samplesPerAxis, frame.frameIndex)));
+
+				for (uint32_t y = startY; y < endY; y++) {
+					for (uint32_t x = startX; x < endX; x++)
+						data.tilePixels[(y - tileY) * TILE_SIZE + x - tileX] = color;
+				}
+			}
+		}
+	}
+
+	return frameBuffer.WriteTile(tile, data.tilePixels.data(), generation);
+}
+
+bool FrameManager::IsWorkingOn(uint32_t generation) const {
+	return threadState == ThreadState::Work && frameGeneration == generation;
 }
@@ -1,37 +1,169 @@
 #pragma once
 
 #include "World.h"
+#include "FrameBuffer.h"
+#include "Wavefront.h"
+#include "Sampler.h"
 
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 enum class ThreadState {
-	Sleep, Quit, Work, AllComplete
+	Quit, Work, AllComplete
 };
 
+// Frames are calculated in passes. The preview passes go from coarse to fine with one sample per pixel block, so every
+// present shows a whole image. The quality pass calculates every pixel with all samples. With PROGRESSIVE_REFINEMENT
+// the passes after it keep adding samples to the pixels' running means until the image stops changing.
+constexpr uint32_t QUALITY_PASS = PREVIEW_PASS_COUNT;
+static_assert(PREVIEW_PASS_COUNT == 0 || (1 << (PREVIEW_PASS_COUNT - 1)) <= TILE_SIZE, "Preview blocks have to fit in a tile");
+
+// Tiles of a frame given to one thread. Other threads steal from the back when they run out.
+struct TileQueue {
+	std::mutex mutex;
+	uint32_t generation = 0; // The frame the tiles are from
+	uint32_t front = 0;
+	uint32_t back = 0;
+	std::array<uint32_t, TILE_COUNT> tiles; // Fixed size, so it is part of the owning thread's memory
+};
+
+// What the threads need to know about a frame. Copied to every thread when it starts the frame.
+struct FrameSettings {
+	Camera camera;
+	float renderScale = 1.0f;      // Part of the window resolution that is calculated. Every calculated pixel is filled to a block of the window
+	int previewSamplesPerAxis = 1; // Samples of the last preview pass
+	glm::vec2 pointOfInterest = { WINDOW_WIDTH * 0.5f, WINDOW_HEIGHT * 0.5f }; // In window pixels
+	uint32_t frameIndex = 0;       // Count of started frames, the samplers give different numbers on every frame
+};
+
+// Marks a render thread that isn't using any world
+constexpr uint64_t IDLE_EPOCH = UINT64_MAX;
+
+// Everything only one render thread writes to. The thread allocates it itself, so with pinning it stays on the thread's NUMA node.
+struct RenderThreadData {
+	TileQueue tileQueue;
+	std::array<uint32_t, TILE_SIZE * TILE_SIZE> tilePixels;
+	std::array<glm::vec3, TILE_SIZE * TILE_SIZE> tileColorSums;
+	std::unique_ptr<Sampler> sampler = Sampler::Create();
+#if WAVEFRONT_RENDERING
+	Wavefront wavefront;
+	std::array<glm::vec2, TILE_SIZE * TILE_SIZE> screenPositions;
+	std::array<glm::vec3, TILE_SIZE * TILE_SIZE> colors;
+#endif
+	FrameSettings frame; // Copy of the settings of the frame being calculated
+	uint32_t pass = 0;
+	std::atomic<uint32_t> calculatedTileAmount = 0; // Benchmarking
+	std::atomic<uint64_t> worldEpoch = IDLE_EPOCH; // World epoch when the thread started using the current world
+};
+
+// Owns the render threads. They are created once and then wait for new frames.
+// A new frame doesn't stop the threads, they notice the new generation between pixels and move on to it.
+// Every pass of a frame is its own generation.
 class FrameManager {
 public:
-	void StartNewFrame();
+	FrameManager();
+	~FrameManager();
+
+	void StartNewFrame(const Camera& camera);
+	// Builds the world with the next time in the background. Doesn't wait for it.
+	void AdvanceWorldTime();
+	// Return: Has a new world been swapped in since the last call
+	bool HasNewWorld() { return worldChanged.exchange(false); }
+	// Where the user is looking, in window pixels. Used from the next frame on.
+	void SetPointOfInterest(glm::vec2 windowPosition) { pointOfInterest = windowPosition; }
 	void TerminateAllThreads();
 
 	bool NeedUpdatingTexture();
 	void FinishFrame();
 
-	// Waits for all the threads to join and returns texturePixels
+	// Copies what has been calculated so far without stopping the threads
 	void* GetTexturePixelsToPresent();
-	void ContinueWorkingOnImage();
 
-	World& GetWorld() {	return world; } 
+	uint32_t GetThreadCount() const { return threadCount; }
 private:
-	void ThreadWork(uint32_t index);
+	void ThreadWork(uint32_t threadIndex);
+	// Return: False if there wasn't enough memory
+	bool CreateThreadData(uint32_t threadIndex, uint32_t numaNode);
+	// Return: False if the frame was abandoned
+	bool CalculateFrameTiles(uint32_t threadIndex, uint32_t generation);
+	bool CalculateTile(RenderThreadData& data, World& world, uint32_t tile, uint32_t generation);
+	// Return: Is there still a tile of the generation to calculate. Steals from the other threads if this thread's queue is empty
+	bool GetNextTile(uint32_t threadIndex, uint32_t generation, uint32_t& outTile);
+	// Return: False if the frame has changed, then the tile doesn't count
+	bool CompleteTile(uint32_t generation, bool& outWasLastTile);
+	// Called by the thread that completed the pass. Starts the next preview pass
+	void FinishPass(uint32_t generation);
+	// Called by the UI thread once the camera has stayed still
+	void StartQualityPass(uint32_t generation);
+	// Called by the UI thread after the quality pass, while the image still changes
+	void StartRefinementPass(uint32_t generation);
+	void StartPass(uint32_t pass); // Only while holding stateMutex
 
-	float time;
-	World world;
-	std::chrono::system_clock::time_point frameStartTime; // Benchmarking
+	// Dynamic resolution, only while holding stateMutex
+	void UpdateRenderScale(std::chrono::steady_clock::time_point now);
+	float GetPreviewProgress() const;
+	static float GetPassCost(uint32_t pass, const FrameSettings& settings); // 1 = one sample for every pixel of the window
+	void DistributeTiles(uint32_t generation);
+	void UpdateTileOrder(); // Only while holding stateMutex
+	// Return: Distance from the tile's center to the point of interest in fovea radiuses
+	static float GetFoveaDistance(uint32_t tile, glm::vec2 pointOfInterest);
+	// Return: Is the generation still the frame to calculate. False if it was abandoned or the threads are quitting
+	bool IsWorkingOn(uint32_t generation) const;
+	void SetThreadState(ThreadState state);
+	void WaitForThreadsToStop();
+	void StopWorking(); // Called by the render threads
+	void WorldBuilderWork();
+	void ReclaimWorlds(); // Called by the world builder
 
+	// The world is never changed while it is used. A new one is built in the background and swapped in, and the old one is
+	// deleted once every render thread has either been idle or started using a world after the swap (epoch based reclamation).
+	std::shared_ptr<Skybox> skybox;
+	std::atomic<World*> currentWorld;
+	std::atomic<uint64_t> worldEpoch = 1; // Increased with every swap
+	std::atomic<bool> worldChanged = false;
+	std::thread worldBuilder;
+	std::mutex worldMutex;
+	std::condition_variable worldUpdateRequested;
+	float requestedTime = 0; // Guarded by worldMutex
+	bool quitWorldBuilder = false; // Guarded by worldMutex
+	std::vector<std::pair<World*, uint64_t>> retiredWorlds; // Only used by the world builder. Has the epoch the world was replaced in
+	std::chrono::steady_clock::time_point frameRequestTime; // When the camera last changed, guarded by stateMutex
+	std::chrono::steady_clock::time_point passStartTime; // Benchmarking
+	std::atomic<bool> firstTileLogged = true; // Benchmarking
+	std::chrono::duration<double, std::micro> presentDuration{ 0 }; // Benchmarking, all presents of the frame
+	int presentAmount = 0; // Benchmarking
+
+	uint32_t threadCount;
 	std::vector<std::thread> threads;
-	std::atomic<ThreadState> threadState = ThreadState::Work;
-	std::atomic<int> runningThreadAmount = 0;
+	std::vector<RenderThreadData*> threadData;
+	// Threads block on these instead of polling. The atomics are only changed while holding the mutex,
+	// so the waits can't miss a change, but the pixel loop can still read them without locking.
+	std::mutex stateMutex;
+	std::condition_variable stateChanged;
+	std::condition_variable threadsStopped;
+	std::atomic<ThreadState> threadState = ThreadState::AllComplete; // Nothing to calculate until the first StartNewFrame
+	// Increased for every new frame. Threads compare it to the frame they are working on
+	std::atomic<uint32_t> frameGeneration = 0;
+	FrameSettings frameSettings; // Settings of the newest frame. Only the UI thread changes them, while holding stateMutex
+	std::atomic<uint32_t> framePass = 0;
+	bool isStillFrame = false; // Restarted at full resolution because the camera stayed still
+	float previewDuration = -1; // Seconds the previews of the newest frame took. Negative until they are done
+	float secondsPerPreviewCost = 0; // Smoothed measurement of how long a GetPassCost of 1 takes
+	float renderScale = 1.0f; // For the next frames that aren't still
+	int previewSamplesPerAxis = 1;
+	glm::vec2 pointOfInterest = { WINDOW_WIDTH * 0.5f, WINDOW_HEIGHT * 0.5f };
+	// Generation in the high bits and the remaining tiles in the low bits, so a late tile of an abandoned frame can't count for a new one
+	std::atomic<uint64_t> frameProgress = 0;
 	std::atomic<int> workingThreadAmount = 0;
-	std::array<uint8_t, WINDOW_WIDTH * WINDOW_HEIGHT * 4> texturePixels;
-};
\ No newline at end of file
+	std::atomic<uint32_t> unconvergedTileAmount = 0; // Tiles of the pass whose samples still changed the image
+	std::atomic<int> stolenTileAmount = 0; // Benchmarking
+
+	// Pixels of a tile in Morton order, so consecutive pixels stay close to each other
+	std::array<glm::u8vec2, TILE_SIZE * TILE_SIZE> tilePixelOrder;
+	// Order the tiles are given to the threads in. Guarded by stateMutex
+	std::array<uint32_t, TILE_COUNT> tileOrder;
+	FrameBuffer frameBuffer;
+	std::array<uint32_t, WINDOW_WIDTH * WINDOW_HEIGHT> presentPixels; // Only used by the UI thread
+};
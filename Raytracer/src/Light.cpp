@@ -0,0 +1,398 @@
+#include "Light.h"
+#include "Constants.h"
+#include "Sampler.h"
+
+#include <limits>
+#include <algorithm>
+
+static const float largestBelowOne = 0x1.fffffep-1f;
+
+static inline float SafeSqrt(float value) { return glm::sqrt(glm::max(value, 0.0f)); }
+// cos and sin of a - b, where a difference below zero counts as zero
+static inline float CosSubClamped(float sinA, float cosA, float sinB, float cosB) { return cosA > cosB ? 1 : cosA * cosB + sinA * sinB; }
+static inline float SinSubClamped(float sinA, float cosA, float sinB, float cosB) { return cosA > cosB ? 0 : sinA * cosB - cosA * sinB; }
+
+float LightBounds::GetImportance(const glm::vec3& point) const {
+	if (power <= 0)
+		return 0;
+
+	const glm::vec3 center = box.CalculatePivot();
+	const float radiusSquared = glm::dot(box.maxCoord - center, box.maxCoord - center);
+	const glm::vec3 toPoint = point - center;
+	const float distanceSquared = glm::dot(toPoint, toPoint);
+
+	// The angle from the axis to the point
+	float cosThetaW = distanceSquared > 0 ? glm::dot(axis, toPoint) / glm::sqrt(distanceSquared) : 1;
+	if (twoSided)
+		cosThetaW = glm::abs(cosThetaW);
+	const float sinThetaW = SafeSqrt(1 - cosThetaW * cosThetaW);
+
+	// Half the angle the box covers seen from the point, all of it from inside
+	const float cosThetaB = distanceSquared > radiusSquared ? SafeSqrt(1 - radiusSquared / distanceSquared) : -1;
+	const float sinThetaB = SafeSqrt(1 - cosThetaB * cosThetaB);
+
+	// The smallest angle between a normal of the cone and a direction from the box to the point
+	const float sinThetaO = SafeSqrt(1 - cosThetaO * cosThetaO);
+	const float cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+	const float sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+	const float cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+	if (cosThetaP <= cosThetaE)
+		return 0;
+
+	// Not closer than the size of the box, so the lights right next to the point don't get all the samples
+	return power * cosThetaP / glm::max(distanceSquared, radiusSquared);
+}
+
+LightBounds LightBounds::Union(const LightBounds& a, const LightBounds& b) {
+	if (a.power <= 0)
+		return b;
+	if (b.power <= 0)
+		return a;
+
+	LightBounds bounds;
+	bounds.box = BoundingBox(glm::min(a.box.minCoord, b.box.minCoord), glm::max(a.box.maxCoord, b.box.maxCoord));
+	bounds.power = a.power + b.power;
+	bounds.cosThetaE = glm::min(a.cosThetaE, b.cosThetaE);
+	bounds.twoSided = a.twoSided || b.twoSided;
+
+	// The smallest cone around both cones
+	const float thetaA = glm::acos(glm::clamp(a.cosThetaO, -1.0f, 1.0f));
+	const float thetaB = glm::acos(glm::clamp(b.cosThetaO, -1.0f, 1.0f));
+	const float thetaD = glm::acos(glm::clamp(glm::dot(a.axis, b.axis), -1.0f, 1.0f));
+	if (glm::min(thetaD + thetaB, glm::pi<float>()) <= thetaA) {
+		bounds.axis = a.axis;
+		bounds.cosThetaO = a.cosThetaO;
+		return bounds;
+	}
+	if (glm::min(thetaD + thetaA, glm::pi<float>()) <= thetaB) {
+		bounds.axis = b.axis;
+		bounds.cosThetaO = b.cosThetaO;
+		return bounds;
+	}
+
+	const float thetaO = (thetaA + thetaD + thetaB) * 0.5f;
+	const glm::vec3 rotationAxis = glm::cross(a.axis, b.axis);
+	if (thetaO >= glm::pi<float>() || glm::dot(rotationAxis, rotationAxis) == 0) {
+		bounds.axis = a.axis;
+		bounds.cosThetaO = -1;
+		return bounds;
+	}
+
+	// Turns the axis of a toward b, so the new cone just reaches over the far edges of both
+	const float thetaR = thetaO - thetaA;
+	bounds.axis = a.axis * glm::cos(thetaR) + glm::cross(glm::normalize(rotationAxis), a.axis) * glm::sin(thetaR);
+	bounds.cosThetaO = glm::cos(thetaO);
+	return bounds;
+}
+
+// The surface area orientation heuristic. Splits that leave bright groups with small boxes and narrow cones are better.
+static float GetSplitCost(const LightBounds& bounds, const BoundingBox& parentBox, int dimension) {
+	if (bounds.power <= 0)
+		return 0;
+
+	const float thetaO = glm::acos(glm::clamp(bounds.cosThetaO, -1.0f, 1.0f));
+	const float thetaE = glm::acos(glm::clamp(bounds.cosThetaE, -1.0f, 1.0f));
+	const float thetaW = glm::min(thetaO + thetaE, glm::pi<float>());
+	const float sinThetaO = SafeSqrt(1 - bounds.cosThetaO * bounds.cosThetaO);
+	const float orientation = 2 * glm::pi<float>() * (1 - bounds.cosThetaO)
+		+ glm::pi<float>() * 0.5f * (2 * thetaW * sinThetaO - glm::cos(thetaO - 2 * thetaW) - 2 * thetaO * sinThetaO + bounds.cosThetaO);
+
+	const glm::vec3 size = bounds.box.maxCoord - bounds.box.minCoord;
+	const float area = 2 * (size.x * size.y + size.y * size.z + size.z * size.x);
+
+	// Long thin parents are better split across
+	const glm::vec3 parentSize = parentBox.maxCoord - parentBox.minCoord;
+	const float aspect = glm::max(parentSize.x, glm::max(parentSize.y, parentSize.z)) / glm::max(parentSize[dimension], 0.0001f);
+	return bounds.power * orientation * area * aspect;
+}
+
+void LightList::Build(const std::vector<Object*>& objects) {
+	nodes.clear();
+	lights.clear();
+	lightIndices.clear();
+
+	std::vector<std::pair<LightBounds, uint32_t>> bounds;
+	for (const Object* object : objects) {
+		if (object->material.materialType != MaterialType::DiffuseLight)
+			continue;
+
+		const Sphere* sphere = dynamic_cast<const Sphere*>(object);
+		const Triangle* triangle = dynamic_cast<const Triangle*>(object);
+		if (sphere)
+			bounds.push_back({ GetBounds(*sphere), (uint32_t)lights.size() });
+		else if (triangle)
+			bounds.push_back({ GetBounds(*triangle), (uint32_t)lights.size() });
+		else
+			continue;
+
+		lightIndices[object] = (uint32_t)lights.size();
+		lights.push_back({ sphere, triangle, 0 });
+	}
+
+	if (!bounds.empty())
+		BuildNode(bounds, 0, bounds.size(), 0, 0);
+}
+
+uint32_t LightList::BuildNode(std::vector<std::pair<LightBounds, uint32_t>>& bounds, size_t begin, size_t end, uint64_t trail, int depth) {
+	const uint32_t nodeIndex = (uint32_t)nodes.size();
+	nodes.push_back({});
+	if (end - begin == 1) {
+		nodes[nodeIndex] = { bounds[begin].first, bounds[begin].second, true };
+		lights[bounds[begin].second].trail = trail;
+		return nodeIndex;
+	}
+
+	LightBounds total;
+	BoundingBox centers(glm::vec3{ std::numeric_limits<float>::max() }, glm::vec3{ std::numeric_limits<float>::lowest() });
+	for (size_t i = begin; i < end; i++) {
+		total = LightBounds::Union(total, bounds[i].first);
+		centers.minCoord = glm::min(centers.minCoord, bounds[i].first.box.CalculatePivot());
+		centers.maxCoord = glm::max(centers.maxCoord, bounds[i].first.box.CalculatePivot());
+	}
+
+	// Sorts the lights to buckets along each axis and tries the splits between the buckets
+	const int bucketCount = 12;
+	float bestCost = std::numeric_limits<float>::max();
+	int bestDimension = -1;
+	int bestSplit = 0;
+	for (int dimension = 0; dimension < 3; dimension++) {
+		const float extent = centers.maxCoord[dimension] - centers.minCoord[dimension];
+		if (extent <= 0)
+			continue;
+
+		LightBounds buckets[bucketCount];
+		for (size_t i = begin; i < end; i++) {
+			const int bucket = glm::min((int)(bucketCount * (bounds[i].first.box.CalculatePivot()[dimension] - centers.minCoord[dimension]) / extent), bucketCount - 1);
+			buckets[bucket] = LightBounds::Union(buckets[bucket], bounds[i].first);
+		}
+
+		for (int split = 1; split < bucketCount; split++) {
+			LightBounds below, above;
+			for (int i = 0; i < split; i++)
+				below = LightBounds::Union(below, buckets[i]);
+			for (int i = split; i < bucketCount; i++)
+				above = LightBounds::Union(above, buckets[i]);
+
+			const float cost = GetSplitCost(below, total.box, dimension) + GetSplitCost(above, total.box, dimension);
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestDimension = dimension;
+				bestSplit = split;
+			}
+		}
+	}
+
+	auto middle = bounds.begin() + (begin + end) / 2;
+	if (bestDimension >= 0 && depth < 32) {
+		const float extent = centers.maxCoord[bestDimension] - centers.minCoord[bestDimension];
+		middle = std::partition(bounds.begin() + begin, bounds.begin() + end, [&](const std::pair<LightBounds, uint32_t>& light) {
+			return (int)(bucketCount * (light.first.box.CalculatePivot()[bestDimension] - centers.minCoord[bestDimension]) / extent) < bestSplit;
+		});
+	}
+	// Halves by count when the buckets couldn't split, or the tree gets too deep for the trails
+	if (middle == bounds.begin() + begin || middle == bounds.begin() + end) {
+		const glm::vec3 extent = centers.maxCoord - centers.minCoord;
+		const int dimension = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		middle = bounds.begin() + (begin + end) / 2;
+		std::nth_element(bounds.begin() + begin, middle, bounds.begin() + end, [&](const std::pair<LightBounds, uint32_t>& a, const std::pair<LightBounds, uint32_t>& b) {
+			return a.first.box.CalculatePivot()[dimension] < b.first.box.CalculatePivot()[dimension];
+		});
+	}
+
+	const size_t split = middle - bounds.begin();
+	const uint32_t first = BuildNode(bounds, begin, split, trail, depth + 1);
+	const uint32_t second = BuildNode(bounds, split, end, trail | (1ull << depth), depth + 1);
+	nodes[nodeIndex] = { LightBounds::Union(nodes[first].bounds, nodes[second].bounds), second, false };
+	return nodeIndex;
+}
+
+void LightList::AddSkybox(const Skybox* skybox) {
+	this->skybox = SAMPLE_SKYBOX && skybox && skybox->CanBeSampled() ? skybox : nullptr;
+}
+
+LightBounds LightList::GetBounds(const Sphere& sphere) {
+	// Light goes out of every side
+	LightBounds bounds;
+	bounds.box = BoundingBox(sphere.pos - sphere.radius, sphere.pos + sphere.radius);
+	bounds.power = glm::pi<float>() * 4 * glm::pi<float>() * sphere.radius * sphere.radius * GetLuminance(sphere.material.emittingColor);
+	bounds.cosThetaO = -1;
+	return bounds;
+}
+
+LightBounds LightList::GetBounds(const Triangle& triangle) {
+	const glm::vec3 normal = glm::cross(triangle.vertices[1].position - triangle.vertices[0].position, triangle.vertices[2].position - triangle.vertices[0].position);
+	const float doubleArea = glm::length(normal);
+
+	LightBounds bounds;
+	bounds.box = triangle.box;
+	bounds.power = doubleArea > 0 ? glm::pi<float>() * doubleArea * GetLuminance(triangle.material.emittingColor) : 0;
+	bounds.axis = doubleArea > 0 ? normal / doubleArea : glm::vec3{ 0, 1, 0 };
+	bounds.twoSided = true;
+	return bounds;
+}
+
+float LightList::GetOneMinusCosThetaMax(const glm::vec3& point, const Sphere& sphere) {
+	const float distanceSquared = glm::dot(sphere.pos - point, sphere.pos - point);
+	const float radiusSquared = sphere.radius * sphere.radius;
+	if (distanceSquared <= radiusSquared)
+		return 0;
+
+	// Same as 1 - sqrt(1 - sin^2), without losing the small cones of far lights
+	const float sinThetaMaxSquared = radiusSquared / distanceSquared;
+	return sinThetaMaxSquared / (1.0f + glm::sqrt(1.0f - sinThetaMaxSquared));
+}
+
+bool LightList::Sample(const glm::vec3& point, float choice, glm::vec2 sample, LightSample& outSample) const {
+	const float skyProbability = GetSkyProbability();
+	if (choice < skyProbability) {
+		float pdf;
+		outSample.direction = skybox->SampleDirection(sample, pdf);
+		if (pdf <= 0)
+			return false;
+
+		outSample.distance = std::numeric_limits<float>::max();
+		outSample.emission = SKYBOX_BRIGHTNESS * skybox->GetPixel(outSample.direction);
+		outSample.pdf = pdf * skyProbability;
+		outSample.object = nullptr;
+		return true;
+	}
+	if (nodes.empty())
+		return false;
+
+	// Walks down the tree, reusing what is left of the choice at every level
+	choice = glm::min((choice - skyProbability) / (1 - skyProbability), largestBelowOne);
+	float probability = 1 - skyProbability;
+	uint32_t node = 0;
+	if (nodes[0].isLeaf && nodes[0].bounds.GetImportance(point) <= 0)
+		return false;
+	while (!nodes[node].isLeaf) {
+		const float first = nodes[node + 1].bounds.GetImportance(point);
+		const float second = nodes[nodes[node].index].bounds.GetImportance(point);
+		if (first + second <= 0)
+			return false;
+
+		const float firstProbability = first / (first + second);
+		if (choice < firstProbability) {
+			choice = glm::min(choice / firstProbability, largestBelowOne);
+			probability *= firstProbability;
+			node = node + 1;
+		}
+		else {
+			choice = glm::min((choice - firstProbability) / (1 - firstProbability), largestBelowOne);
+			probability *= 1 - firstProbability;
+			node = nodes[node].index;
+		}
+	}
+
+	const Light& light = lights[nodes[node].index];
+	if (!(light.sphere ? SampleSphere(point, *light.sphere, sample, outSample) : SampleTriangle(point, *light.triangle, sample, outSample)))
+		return false;
+	outSample.pdf *= probability;
+	return true;
+}
+
+float LightList::GetPdf(const Ray& ray, const Object* object) const {
+	if (!object)
+		return skybox ? skybox->GetPdf(ray.direction) * GetSkyProbability() : 0;
+
+	const auto index = lightIndices.find(object);
+	if (index == lightIndices.end())
+		return 0;
+
+	const Light& light = lights[index->second];
+	const float pdf = light.sphere ? GetSpherePdf(ray.pos, *light.sphere) : GetTrianglePdf(ray, *light.triangle);
+	return pdf > 0 ? pdf * (1 - GetSkyProbability()) * GetTreeProbability(ray.pos, index->second) : 0;
+}
+
+float LightList::GetTreeProbability(const glm::vec3& point, uint32_t light) const {
+	if (nodes[0].isLeaf)
+		return nodes[0].bounds.GetImportance(point) > 0 ? 1.0f : 0.0f;
+
+	// The same choices as Sample, read from the trail
+	const uint64_t trail = lights[light].trail;
+	float probability = 1;
+	uint32_t node = 0;
+	for (int depth = 0; !nodes[node].isLeaf; depth++) {
+		const float first = nodes[node + 1].bounds.GetImportance(point);
+		const float second = nodes[nodes[node].index].bounds.GetImportance(point);
+		if (first + second <= 0)
+			return 0;
+
+		const bool isSecond = (trail >> depth) & 1;
+		probability *= (isSecond ? second : first) / (first + second);
+		node = isSecond ? nodes[node].index : node + 1;
+	}
+	return probability;
+}
+
+bool LightList::SampleSphere(const glm::vec3& point, const Sphere& sphere, glm::vec2 sample, LightSample& outSample) {
+	const float oneMinusCosThetaMax = GetOneMinusCosThetaMax(point, sphere);
+	if (oneMinusCosThetaMax <= 0)
+		return false;
+
+	const glm::vec3 toCenter = sphere.pos - point;
+	const float centerDistance = glm::length(toCenter);
+	outSample.direction = SampleCone(sample, toCenter / centerDistance, oneMinusCosThetaMax);
+
+	// The nearer hit of the direction with the sphere. The direction is inside the cone, so it always hits
+	const float projected = glm::dot(outSample.direction, toCenter);
+	const float discriminant = projected * projected - centerDistance * centerDistance + sphere.radius * sphere.radius;
+	outSample.distance = projected - glm::sqrt(glm::max(discriminant, 0.0f));
+
+	outSample.emission = sphere.material.emittingColor;
+	outSample.pdf = GetConePdf(oneMinusCosThetaMax);
+	outSample.object = &sphere;
+	return true;
+}
+
+float LightList::GetSpherePdf(const glm::vec3& point, const Sphere& sphere) {
+	const float oneMinusCosThetaMax = GetOneMinusCosThetaMax(point, sphere);
+	return oneMinusCosThetaMax > 0 ? GetConePdf(oneMinusCosThetaMax) : 0;
+}
+
+bool LightList::SampleTriangle(const glm::vec3& point, const Triangle& triangle, glm::vec2 sample, LightSample& outSample) {
+	const glm::vec3& a = triangle.vertices[0].position;
+	const glm::vec3& b = triangle.vertices[1].position;
+	const glm::vec3& c = triangle.vertices[2].position;
+	const glm::vec3 normal = glm::cross(b - a, c - a);
+	const float doubleArea = glm::length(normal);
+	if (doubleArea <= 0)
+		return false;
+
+	// Every point of the triangle as likely
+	const float root = glm::sqrt(sample.x);
+	const glm::vec3 toLight = a * (1 - root) + b * (root * (1 - sample.y)) + c * (root * sample.y) - point;
+	const float distanceSquared = glm::dot(toLight, toLight);
+	if (distanceSquared <= 0)
+		return false;
+
+	outSample.distance = glm::sqrt(distanceSquared);
+	outSample.direction = toLight / outSample.distance;
+
+	// From per area to per solid angle
+	const float cosLight = glm::abs(glm::dot(normal, outSample.direction)) / doubleArea;
+	if (cosLight <= 0)
+		return false;
+
+	outSample.emission = triangle.material.emittingColor;
+	outSample.pdf = distanceSquared / (cosLight * doubleArea * 0.5f);
+	outSample.object = &triangle;
+	return true;
+}
+
+float LightList::GetTrianglePdf(const Ray& ray, const Triangle& triangle) {
+	const glm::vec3& a = triangle.vertices[0].position;
+	const glm::vec3 normal = glm::cross(triangle.vertices[1].position - a, triangle.vertices[2].position - a);
+	const float doubleArea = glm::length(normal);
+	const float denominator = glm::dot(normal, ray.direction);
+	if (doubleArea <= 0 || denominator == 0)
+		return 0;
+
+	// The ray hit the triangle, so its plane is enough for the distance
+	const float distance = glm::dot(a - ray.pos, normal) / denominator;
+	if (distance <= 0)
+		return 0;
+
+	const float cosLight = glm::abs(denominator) / doubleArea;
+	return distance * distance / (cosLight * doubleArea * 0.5f);
+}
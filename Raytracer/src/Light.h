@@ -0,0 +1,84 @@
+#pragma once
+#include "Object.h"
+
+#include <vector>
+#include <unordered_map>
+
+// A direction toward a light from a point in the scene
+struct LightSample {
+	glm::vec3 direction;
+	float distance;         // To the point on the light, infinite for the skybox
+	glm::vec3 emission;
+	float pdf;              // Per solid angle, times the chance of choosing the light
+	const Object* object;   // Null for the skybox
+};
+
+// What a group of lights can at most send toward a point, by Conty Estevez and Kulla
+struct LightBounds {
+	// Return: A guess of the light of the group on the point. Zero only if none of it can reach the point
+	float GetImportance(const glm::vec3& point) const;
+	static LightBounds Union(const LightBounds& a, const LightBounds& b);
+
+	BoundingBox box;
+	float power = 0;
+	glm::vec3 axis{ 0, 1, 0 }; // The surface normals of the lights are inside a cone around this
+	float cosThetaO = 1;       // Half angle of the cone of the normals
+	float cosThetaE = 0;       // How far from its normal a surface emits
+	bool twoSided = false;     // Emits on both sides of the normals
+};
+
+// The objects that emit light and can be sampled directly. Built with the scene, so a path can pick a
+// light and aim a shadow ray at it instead of waiting for a bounce to hit it by chance.
+// The emitters are spheres and triangles with a DiffuseLight material that aren't inside another object. Other emitters are only found by bounces.
+// The lights are in a tree of LightBounds. A sample walks down it picking the child that likely gives more light to the point,
+// so a light is picked about in proportion to its light there, in time logarithmic to the number of lights.
+// With SAMPLE_SKYBOX the skybox is picked as often as the tree.
+class LightList {
+public:
+	void Build(const std::vector<Object*>& objects);
+	void AddSkybox(const Skybox* skybox);
+	bool IsEmpty() const { return nodes.empty() && !skybox; }
+
+	// Picks a light with the choice and a direction toward it from the point
+	// Return: Was there a light to sample
+	bool Sample(const glm::vec3& point, float choice, glm::vec2 sample, LightSample& outSample) const;
+	// Return: The pdf of Sample giving the direction of the ray toward the object, or the skybox if the object is null. Zero if it can't be sampled
+	float GetPdf(const Ray& ray, const Object* object) const;
+
+private:
+	struct Node {
+		LightBounds bounds;
+		uint32_t index;  // Of the light in a leaf, of the second child otherwise. The first child is the next node
+		bool isLeaf;
+	};
+	struct Light {
+		const Sphere* sphere;     // One of these is set
+		const Triangle* triangle;
+		uint64_t trail;           // The choices down the tree to the leaf, a bit for each level. Set bit is the second child
+	};
+
+	// Return: The index of the node
+	uint32_t BuildNode(std::vector<std::pair<LightBounds, uint32_t>>& bounds, size_t begin, size_t end, uint64_t trail, int depth);
+	float GetSkyProbability() const { return skybox ? (nodes.empty() ? 1.0f : 0.5f) : 0.0f; }
+	// Return: The chance of walking down the tree to the light
+	float GetTreeProbability(const glm::vec3& point, uint32_t light) const;
+
+	static LightBounds GetBounds(const Sphere& sphere);
+	static LightBounds GetBounds(const Triangle& triangle);
+	static bool SampleSphere(const glm::vec3& point, const Sphere& sphere, glm::vec2 sample, LightSample& outSample);
+	static bool SampleTriangle(const glm::vec3& point, const Triangle& triangle, glm::vec2 sample, LightSample& outSample);
+	static float GetSpherePdf(const glm::vec3& point, const Sphere& sphere);
+	static float GetTrianglePdf(const Ray& ray, const Triangle& triangle);
+	// Return: 1 - cos of the half angle of the cone, 0 if the point is inside the sphere
+	static float GetOneMinusCosThetaMax(const glm::vec3& point, const Sphere& sphere);
+
+	std::vector<Node> nodes; // Depth first, the root is the first
+	std::vector<Light> lights;
+	std::unordered_map<const Object*, uint32_t> lightIndices;
+	const Skybox* skybox = nullptr;
+};
+
+// The power heuristic of Veach with a power of two. Weights a sample by how much better its strategy was at finding it than the other.
+inline float GetMisWeight(float pdf, float otherPdf) {
+	return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
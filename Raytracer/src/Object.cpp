@@ -7,6 +7,28 @@
 #include <gtc/constants.hpp>
 #include <gtx/component_wise.hpp>
 
+void Object::IntersectPacket(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask) const {
+	for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+		if ((activeMask & (1 << i)) == 0)
+			continue;
+
+		HitInfo hitInfo;
+		if (Intersect(packet.GetRay(i), hitInfo) && hitInfo.distance < hitInfos[i].distance)
+			hitInfos[i] = hitInfo;
+	}
+}
+
+bool Object::Occluded(const Ray& ray, float maxDistance) const {
+	HitInfo hitInfo;
+	return Intersect(ray, hitInfo) && hitInfo.distance < maxDistance;
+}
+
+// Empty hits as far as the current ones, so an object reports only closer hits into them
+static inline void InitializeCloserHits(const HitInfo* hitInfos, HitInfo* outCloserHits) {
+	for (int i = 0; i < RAY_PACKET_SIZE; i++)
+		outCloserHits[i].distance = hitInfos[i].distance;
+}
+
 bool Sphere::Intersect(const Ray& ray, HitInfo& hitInfo) const {
 	glm::vec3 distance = ray.pos - pos;
 	float p1 = -glm::dot(ray.direction, distance);
@@ -26,6 +48,16 @@ bool Sphere::Intersect(const Ray& ray, HitInfo& hitInfo) const {
 
 	return true;
 }
+bool Sphere::Occluded(const Ray& ray, float maxDistance) const {
+	glm::vec3 distance = ray.pos - pos;
+	float p1 = -glm::dot(ray.direction, distance);
+	float p2sqr = p1 * p1 - glm::dot(distance, distance) + radius * radius;
+	if (p2sqr < 0)
+		return false;
+
+	float hitDistance = p1 - sqrt(p2sqr);
+	return hitDistance >= 0 && hitDistance < maxDistance;
+}
 bool Sphere::GetBoundingBox(BoundingBox& outBox) const {
 	outBox = BoundingBox(
 		pos - glm::vec3(radius, radius, radius),
@@ -178,7 +210,7 @@ bool box_x_compare(const Object* a, const Object* b) { return CompareObjectAxis(
 bool box_y_compare(const Object* a, const Object* b) { return CompareObjectAxis(a, b, 1); }
 bool box_z_compare(const Object* a, const Object* b) { return CompareObjectAxis(a, b, 2); }
 
-BVH_Node::BVH_Node(const std::vector<Object*>& scrObjects, int start, int end) {
+BVH_Node::BVH_Node(const std::vector<Object*>& scrObjects, int start, int end, Random& random) {
 
 	/*
 	1. randomly choose an axis
@@ -188,7 +220,7 @@ BVH_Node::BVH_Node(const std::vector<Object*>& scrObjects, int start, int end) {
 
 	auto objects = scrObjects; // Create a modifiable array of the source scene objects
 
-	int axis = (int)(Random01() * 3);
+	int axis = (int)(random.Next01() * 3);
 	auto comparator = (axis == 0) ? box_x_compare
 					: (axis == 1) ? box_y_compare
 								  : box_z_compare;
@@ -212,8 +244,8 @@ BVH_Node::BVH_Node(const std::vector<Object*>& scrObjects, int start, int end) {
 		std::sort(objects.begin() + start, objects.begin() + end, comparator);
 
 		auto mid = start + object_span / 2;
-		left = new BVH_Node(objects, start, mid);
-		right = new BVH_Node(objects, mid, end);
+		left = new BVH_Node(objects, start, mid, random);
+		right = new BVH_Node(objects, mid, end, random);
 	}
 
 	BoundingBox box_left, box_right;
@@ -243,6 +275,9 @@ bool BVH_Node::Intersect(const Ray& ray, HitInfo& hitInfo) const {
 		return false;
 	
 	bool hit_left = left->Intersect(ray, hitInfo);
+	// A node of one object has it on both sides. Fog would get two chances to scatter the ray
+	if (right == left)
+		return hit_left;
 	HitInfo info2;
 	bool hit_right = right->Intersect(ray, info2);
 	if (hit_right && (!hit_left || (hit_left && info2.distance < hitInfo.distance)) )
@@ -251,6 +286,34 @@ bool BVH_Node::Intersect(const Ray& ray, HitInfo& hitInfo) const {
 	return hit_left || hit_right;
 }
 
+bool BVH_Node::Occluded(const Ray& ray, float maxDistance) const {
+	float entry, exit;
+	if (!boundingBox.GetRayHitDistances(ray, entry, exit) || entry >= maxDistance)
+		return false;
+
+	return left->Occluded(ray, maxDistance) || (right != left && right->Occluded(ray, maxDistance));
+}
+
+void BVH_Node::IntersectPacket(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask) const {
+	float closestDistances[RAY_PACKET_SIZE];
+	for (int i = 0; i < RAY_PACKET_SIZE; i++)
+		closestDistances[i] = hitInfos[i].distance;
+
+	activeMask &= boundingBox.GetPacketHitMask(packet, closestDistances);
+	if (activeMask == 0)
+		return;
+
+	// The rays have gone separate ways, one is faster alone
+	if ((activeMask & (activeMask - 1)) == 0) {
+		Object::IntersectPacket(packet, hitInfos, activeMask);
+		return;
+	}
+
+	left->IntersectPacket(packet, hitInfos, activeMask);
+	if (right != left)
+		right->IntersectPacket(packet, hitInfos, activeMask);
+}
+
 inline void InitializeRotationTransform(const float& angle, const Object* target, float& sinTheta, float& cosTheta, bool& boxExists,
 	glm::vec3& pivot, BoundingBox& box, int axisIndex1, int axisIndex2, int rotationAxis)
 {
@@ -300,27 +363,29 @@ ApplyXRotation::ApplyXRotation(float degress, Object* target) : target(target),
 	InitializeRotationTransform(angle, target, sinTheta, cosTheta, boxExists, pivot, box, 1, 2, 0);
 }
 
-bool RotationIntersect(const Ray& ray, HitInfo& hitInfo, const glm::vec3& pivot, const float& sinTheta,
-					   const float& cosTheta, Object*const & target, const int axisIndex1, const int axisIndex2) 
-{
+// Return: The ray in the space of the rotated object
+static inline Ray RotateRay(const Ray& ray, const glm::vec3& pivot, const float& sinTheta, const float& cosTheta, const int axisIndex1, const int axisIndex2) {
 	glm::vec3 originOriginal = ray.pos - pivot;
 	glm::vec3 originModified = originOriginal;
 	glm::vec3 direction = ray.direction;
 
-    originModified[axisIndex1] = cosTheta * originOriginal[axisIndex1] - sinTheta * originOriginal[axisIndex2];
-    originModified[axisIndex2] = sinTheta*originOriginal[axisIndex1] + cosTheta*originOriginal[axisIndex2];
+	originModified[axisIndex1] = cosTheta * originOriginal[axisIndex1] - sinTheta * originOriginal[axisIndex2];
+	originModified[axisIndex2] = sinTheta * originOriginal[axisIndex1] + cosTheta * originOriginal[axisIndex2];
 
-    direction[axisIndex1] = cosTheta*ray.direction[axisIndex1] - sinTheta*ray.direction[axisIndex2];
-    direction[axisIndex2] = sinTheta*ray.direction[axisIndex1] + cosTheta*ray.direction[axisIndex2];
-
-    Ray rotated(originModified + pivot, direction);
+	direction[axisIndex1] = cosTheta * ray.direction[axisIndex1] - sinTheta * ray.direction[axisIndex2];
+	direction[axisIndex2] = sinTheta * ray.direction[axisIndex1] + cosTheta * ray.direction[axisIndex2];
+	return Ray(originModified + pivot, direction);
+}
 
-    if (!target->Intersect(rotated, hitInfo))
+bool RotationIntersect(const Ray& ray, HitInfo& hitInfo, const glm::vec3& pivot, const float& sinTheta,
+					   const float& cosTheta, Object*const & target, const int axisIndex1, const int axisIndex2) 
+{
+    if (!target->Intersect(RotateRay(ray, pivot, sinTheta, cosTheta, axisIndex1, axisIndex2), hitInfo))
         return false;
 
 	// Transform the data back
-	originOriginal = hitInfo.point - pivot;
-	originModified = originOriginal;
+	glm::vec3 originOriginal = hitInfo.point - pivot;
+	glm::vec3 originModified = originOriginal;
     glm::vec3 normal = hitInfo.normal;
 
     originModified[axisIndex1] =  cosTheta*originOriginal[axisIndex1] + sinTheta*originOriginal[axisIndex2];
@@ -335,6 +400,39 @@ bool RotationIntersect(const Ray& ray, HitInfo& hitInfo, const glm::vec3& pivot,
     return true;
 }
 
+void RotationIntersectPacket(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask, const glm::vec3& pivot, const float& sinTheta,
+							 const float& cosTheta, Object* const& target, const int axisIndex1, const int axisIndex2)
+{
+	RayPacket rotated;
+	for (int i = 0; i < RAY_PACKET_SIZE; i++)
+		rotated.SetRay(i, RotateRay(packet.GetRay(i), pivot, sinTheta, cosTheta, axisIndex1, axisIndex2));
+
+	HitInfo closerHits[RAY_PACKET_SIZE];
+	InitializeCloserHits(hitInfos, closerHits);
+	target->IntersectPacket(rotated, closerHits, activeMask);
+
+	// Transform the data back
+	for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+		if (closerHits[i].object == nullptr)
+			continue;
+
+		HitInfo& hitInfo = closerHits[i];
+		glm::vec3 originOriginal = hitInfo.point - pivot;
+		glm::vec3 originModified = originOriginal;
+		glm::vec3 normal = hitInfo.normal;
+
+		originModified[axisIndex1] =  cosTheta * originOriginal[axisIndex1] + sinTheta * originOriginal[axisIndex2];
+		originModified[axisIndex2] = -sinTheta * originOriginal[axisIndex1] + cosTheta * originOriginal[axisIndex2];
+
+		normal[axisIndex1] =  cosTheta * hitInfo.normal[axisIndex1] + sinTheta * hitInfo.normal[axisIndex2];
+		normal[axisIndex2] = -sinTheta * hitInfo.normal[axisIndex1] + cosTheta * hitInfo.normal[axisIndex2];
+
+		hitInfo.point = originModified + pivot;
+		hitInfo.normal = normal;
+		hitInfos[i] = hitInfo;
+	}
+}
+
 bool ApplyYRotation::Intersect(const Ray& ray, HitInfo& hitInfo) const {
 	return RotationIntersect(ray, hitInfo, pivot, sinTheta, cosTheta, target, 0, 2);
 }
@@ -344,6 +442,25 @@ bool ApplyZRotation::Intersect(const Ray& ray, HitInfo& hitInfo) const {
 bool ApplyXRotation::Intersect(const Ray& ray, HitInfo& hitInfo) const {
 	return RotationIntersect(ray, hitInfo, pivot, sinTheta, cosTheta, target, 1, 2);
 }
+// Rotating keeps the distances the same
+bool ApplyYRotation::Occluded(const Ray& ray, float maxDistance) const {
+	return target->Occluded(RotateRay(ray, pivot, sinTheta, cosTheta, 0, 2), maxDistance);
+}
+bool ApplyZRotation::Occluded(const Ray& ray, float maxDistance) const {
+	return target->Occluded(RotateRay(ray, pivot, sinTheta, cosTheta, 0, 1), maxDistance);
+}
+bool ApplyXRotation::Occluded(const Ray& ray, float maxDistance) const {
+	return target->Occluded(RotateRay(ray, pivot, sinTheta, cosTheta, 1, 2), maxDistance);
+}
+void ApplyYRotation::IntersectPacket(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask) const {
+	RotationIntersectPacket(packet, hitInfos, activeMask, pivot, sinTheta, cosTheta, target, 0, 2);
+}
+void ApplyZRotation::IntersectPacket(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask) const {
+	RotationIntersectPacket(packet, hitInfos, activeMask, pivot, sinTheta, cosTheta, target, 0, 1);
+}
+void ApplyXRotation::IntersectPacket(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask) const {
+	RotationIntersectPacket(packet, hitInfos, activeMask, pivot, sinTheta, cosTheta, target, 1, 2);
+}
 
 // genpfault on stackoverflow
 std::vector<Vertex> LoadOBJ( std::istream& in ) {
@@ -493,9 +610,22 @@ bool PolygonMesh::Intersect(const Ray& ray, HitInfo& hitInfo) const {
 	}
 	else return false;
 }
+void PolygonMesh::IntersectPacket(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask) const {
+	HitInfo closerHits[RAY_PACKET_SIZE];
+	InitializeCloserHits(hitInfos, closerHits);
+	triangles->IntersectPacket(packet, closerHits, activeMask);
+
+	for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+		if (closerHits[i].object == nullptr)
+			continue;
+
+		hitInfos[i] = closerHits[i];
+		hitInfos[i].object = (Object*)this;
+	}
+}
 
 // modified MllerTrumbore intersection algorithm
-bool Triangle::Intersect(const Ray& ray, HitInfo& hitInfo) const {
+inline float Triangle::GetHitDistance(const Ray& ray) const {
 
 	const float EPSILON = 0.0000001f;
 	const glm::vec3& vertex0 = vertices[0].position;
@@ -508,51 +638,80 @@ bool Triangle::Intersect(const Ray& ray, HitInfo& hitInfo) const {
 	h = glm::cross(ray.direction, edge2);
 	a = glm::dot(edge1, h);
 	if (a > -EPSILON && a < EPSILON)
-		return false ;    // This ray is parallel to this triangle.
+		return 0;    // This ray is parallel to this triangle.
 	f = 1.0f / a;
 	s = ray.pos - vertex0;
 	u = f * glm::dot(s, h);
 	if (u < 0.0f || u > 1.0f)
-		return false;
+		return 0;
 	q = glm::cross(s, edge1);
 	v = f * glm::dot(ray.direction, q);
 	if (v < 0.0f || u + v > 1.0f)
-		return false;
+		return 0;
 	// At this stage we can compute t to find out where the intersection point is on the line.
 	float t = f * glm::dot(edge2, q);
 	if (t > EPSILON) // ray intersection
-	{
-		const glm::vec3& h  = ray.pos + ray.direction * t;
-		const glm::vec3& p1 = vertex0;
-		const glm::vec3& p2 = vertex1;
-		const glm::vec3& p3 = vertex2;
-		// Calculate UVs using barycentric coordinates
-		float denominator = p1.y*(p2.z-p3.z)-p2.y*(p1.z-p3.z)+p3.y*(p1.z-p2.z);
-		if (denominator == 0) // The points are colinear, so this can't be computed
-			return false;
-
-		hitInfo.distance = t;
-		hitInfo.normal = vertices[0].normal; // They should all be the same, doesn't matter what we choose
-		hitInfo.object = (Object*)this;
-		hitInfo.point = h + hitInfo.normal * 0.01f;
-
-		float percent0 =  (h.y*(p2.z-p3.z)-h.z*(p2.y-p3.y)+p2.y*p3.z-p3.y*p2.z)/denominator;
-		float percent1 = -(h.y*(p1.z-p3.z)-h.z*(p1.y-p3.y)+p1.y*p3.z-p3.y*p1.z)/denominator;
-		float percent2 =  (h.y*(p1.z-p2.z)-h.z*(p1.y-p2.y)+p1.y*p2.z-p2.y*p1.z)/denominator;
-		hitInfo.uv = vertices[0].texcoord * percent0 + vertices[1].texcoord * percent1 + vertices[2].texcoord * percent2;
-
-		// Wrapping
-		hitInfo.uv -= (glm::uvec2)hitInfo.uv;
-		if (hitInfo.uv.x < 0) hitInfo.uv.x += 1;
-		if (hitInfo.uv.y < 0) hitInfo.uv.y += 1;
-
-		if (!material.texture->IsSolidInPosition(hitInfo.uv, hitInfo.point))
-			return false;
-
-		return true;
-	}
+		return t;
 	else // This means that there is a line intersection but not a ray intersection.
+		return 0;
+}
+
+// The denominator of the barycentric coordinates. Zero if the points are colinear, so the UVs can't be computed
+static inline float GetBarycentricDenominator(const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3) {
+	return p1.y*(p2.z-p3.z)-p2.y*(p1.z-p3.z)+p3.y*(p1.z-p2.z);
+}
+
+inline glm::vec2 Triangle::GetUV(const glm::vec3& h) const {
+	const glm::vec3& p1 = vertices[0].position;
+	const glm::vec3& p2 = vertices[1].position;
+	const glm::vec3& p3 = vertices[2].position;
+	// Calculate UVs using barycentric coordinates
+	float denominator = GetBarycentricDenominator(p1, p2, p3);
+
+	float percent0 =  (h.y*(p2.z-p3.z)-h.z*(p2.y-p3.y)+p2.y*p3.z-p3.y*p2.z)/denominator;
+	float percent1 = -(h.y*(p1.z-p3.z)-h.z*(p1.y-p3.y)+p1.y*p3.z-p3.y*p1.z)/denominator;
+	float percent2 =  (h.y*(p1.z-p2.z)-h.z*(p1.y-p2.y)+p1.y*p2.z-p2.y*p1.z)/denominator;
+	glm::vec2 uv = vertices[0].texcoord * percent0 + vertices[1].texcoord * percent1 + vertices[2].texcoord * percent2;
+
+	// Wrapping
+	uv -= (glm::uvec2)uv;
+	if (uv.x < 0) uv.x += 1;
+	if (uv.y < 0) uv.y += 1;
+	return uv;
+}
+
+bool Triangle::Intersect(const Ray& ray, HitInfo& hitInfo) const {
+	const float t = GetHitDistance(ray);
+	if (t == 0)
+		return false;
+	if (GetBarycentricDenominator(vertices[0].position, vertices[1].position, vertices[2].position) == 0)
+		return false;
+
+	const glm::vec3 h = ray.pos + ray.direction * t;
+	hitInfo.distance = t;
+	hitInfo.normal = vertices[0].normal; // They should all be the same, doesn't matter what we choose
+	hitInfo.object = (Object*)this;
+	hitInfo.point = h + hitInfo.normal * 0.01f;
+	hitInfo.uv = GetUV(h);
+
+	// Lights have no texture
+	if (material.texture && !material.texture->IsSolidInPosition(hitInfo.uv, hitInfo.point))
+		return false;
+
+	return true;
+}
+
+bool Triangle::Occluded(const Ray& ray, float maxDistance) const {
+	const float t = GetHitDistance(ray);
+	if (t == 0 || t >= maxDistance)
+		return false;
+	if (GetBarycentricDenominator(vertices[0].position, vertices[1].position, vertices[2].position) == 0)
 		return false;
+	if (!material.texture || !material.texture->HasHoles())
+		return true;
+
+	const glm::vec3 h = ray.pos + ray.direction * t;
+	return material.texture->IsSolidInPosition(GetUV(h), h + vertices[0].normal * 0.01f);
 }
 
 bool Fog::Intersect(const Ray& ray, HitInfo& hitInfo) const {
@@ -576,7 +735,7 @@ bool Fog::Intersect(const Ray& ray, HitInfo& hitInfo) const {
 	}
 
 	// If the fog was infinite, how far would the ray travel?
-	float supposedHitDistance = negInverseDensity * glm::log(Random01());
+	float supposedHitDistance = negInverseDensity * glm::log(GetThreadRandom().Next01());
 	float travelDistanceInside = glm::distance(fogEnterPoint, fogExitPoint);
 	if (supposedHitDistance > travelDistanceInside) {
 		return false;
@@ -607,6 +766,27 @@ bool ApplyMovement::Intersect(const Ray& ray, HitInfo& hitInfo) const {
 	return true;
 }
 
+void ApplyMovement::IntersectPacket(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask) const {
+	RayPacket translated = packet;
+	for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+		translated.posX[i] -= offset.x;
+		translated.posY[i] -= offset.y;
+		translated.posZ[i] -= offset.z;
+	}
+
+	HitInfo closerHits[RAY_PACKET_SIZE];
+	InitializeCloserHits(hitInfos, closerHits);
+	target->IntersectPacket(translated, closerHits, activeMask);
+
+	for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+		if (closerHits[i].object == nullptr)
+			continue;
+
+		hitInfos[i] = closerHits[i];
+		hitInfos[i].point += offset;
+	}
+}
+
 bool ApplyMovement::GetBoundingBox(BoundingBox& outBox) const {
 	target->GetBoundingBox(outBox);
 	outBox.minCoord += offset;
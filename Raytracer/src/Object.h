@@ -8,10 +8,19 @@ struct Object {
 	virtual ~Object() = default;
 
 	virtual bool Intersect(const Ray& ray, HitInfo& hitInfo) const = 0;
+	// Intersects the rays of the packet that have their bit set in activeMask. A hitInfo is only replaced by a closer hit.
+	// By default the rays are intersected one at a time.
+	virtual void IntersectPacket(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask) const;
+	// Return: Does the ray hit anything closer than maxDistance. Stops at the first hit it finds and doesn't fill a HitInfo,
+	// for shadow rays and other visibility tests. By default uses Intersect.
+	virtual bool Occluded(const Ray& ray, float maxDistance) const;
 	
 	// Return: Has bounding box
 	virtual bool GetBoundingBox(BoundingBox& outBox) const = 0;
 
+	// Objects made of many primitives can have a different material per primitive
+	virtual const Material& GetMaterial(const HitInfo& hitInfo) const { return material; }
+
 	Material material;
 };
 
@@ -19,6 +28,7 @@ struct Sphere : public Object {
 	Sphere(glm::vec3 pos, float radius, Material mat) : Object(mat), pos(pos), radius(radius) {}
 
 	bool Intersect(const Ray& ray, HitInfo& hitInfo) const override;
+	bool Occluded(const Ray& ray, float maxDistance) const override;
 	bool GetBoundingBox(BoundingBox& outBox) const override;
 
 	glm::vec3 pos{ 0 };
@@ -58,11 +68,14 @@ struct Fog : public Object {
 
 struct BVH_Node : public Object {
 	BVH_Node() = default;
-	BVH_Node(const std::vector<Object*>& scrObjects) : BVH_Node(scrObjects, 0, (int)scrObjects.size()) {}
-	BVH_Node(const std::vector<Object*>& scrObjects, int start, int end);
+	// The split axes are random, the seed keeps the tree the same every time
+	BVH_Node(const std::vector<Object*>& scrObjects, Random&& random = Random(0)) : BVH_Node(scrObjects, 0, (int)scrObjects.size(), random) {}
+	BVH_Node(const std::vector<Object*>& scrObjects, int start, int end, Random& random);
 	~BVH_Node();
 
 	bool Intersect(const Ray& ray, HitInfo& hitInfo) const override;
+	void IntersectPacket(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask) const override;
+	bool Occluded(const Ray& ray, float maxDistance) const override;
 	bool GetBoundingBox(BoundingBox& outBox) const override { outBox = boundingBox; return true; }
 
 	Object* left = nullptr;
@@ -84,16 +97,25 @@ struct Triangle : public Object {
 		box(BoundingBox(glm::min(v1.position, glm::min(v2.position, v3.position)), glm::max(v1.position, glm::max(v2.position, v3.position)))) {}
 
 	bool Intersect(const Ray& ray, HitInfo& hitInfo) const override;
+	// Only finds the texture coordinates when the texture has holes
+	bool Occluded(const Ray& ray, float maxDistance) const override;
 	bool GetBoundingBox(BoundingBox& outBox) const override { outBox = box; return true; }
 
+	// Return: The distance to the hit, 0 if the ray misses
+	inline float GetHitDistance(const Ray& ray) const;
+	inline glm::vec2 GetUV(const glm::vec3& point) const;
+
 	Vertex vertices[3];
 	BoundingBox box;
 };
 
 struct PolygonMesh : public Object {
     PolygonMesh(std::string pathToObjFile, float size, Material material);
+	~PolygonMesh() { delete triangles; }
 
 	bool Intersect(const Ray& ray, HitInfo& hitInfo) const override;
+	void IntersectPacket(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask) const override;
+	bool Occluded(const Ray& ray, float maxDistance) const override { return triangles->Occluded(ray, maxDistance); }
 	bool GetBoundingBox(BoundingBox& outBox) const override { return triangles->GetBoundingBox(outBox); }
 
 	BVH_Node* triangles;
@@ -104,6 +126,8 @@ struct ApplyYRotation : public Object {
 	~ApplyYRotation() { delete target; }
 	
 	bool Intersect(const Ray& ray, HitInfo& hitInfo) const override;
+	void IntersectPacket(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask) const override;
+	bool Occluded(const Ray& ray, float maxDistance) const override;
 	bool GetBoundingBox(BoundingBox& outBox) const override { outBox = box; return true; }
 
 	Object* target;
@@ -119,6 +143,8 @@ struct ApplyZRotation : public Object {
 	~ApplyZRotation() { delete target; }
 	
 	bool Intersect(const Ray& ray, HitInfo& hitInfo) const override;
+	void IntersectPacket(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask) const override;
+	bool Occluded(const Ray& ray, float maxDistance) const override;
 	bool GetBoundingBox(BoundingBox& outBox) const override { outBox = box; return true; }
 
 	Object* target;
@@ -134,6 +160,8 @@ struct ApplyXRotation : public Object {
 	~ApplyXRotation() { delete target; }
 	
 	bool Intersect(const Ray& ray, HitInfo& hitInfo) const override;
+	void IntersectPacket(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask) const override;
+	bool Occluded(const Ray& ray, float maxDistance) const override;
 	bool GetBoundingBox(BoundingBox& outBox) const override { outBox = box; return true; }
 
 	Object* target;
@@ -149,6 +177,8 @@ struct ApplyMovement : public Object {
 	~ApplyMovement() { delete target; }
 	
 	bool Intersect(const Ray& ray, HitInfo& hitInfo) const override;
+	void IntersectPacket(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask) const override;
+	bool Occluded(const Ray& ray, float maxDistance) const override { return target->Occluded(Ray(ray.pos - offset, ray.direction), maxDistance); }
 	bool GetBoundingBox(BoundingBox& outBox) const override;
 
 	glm::vec3 offset;
@@ -0,0 +1,77 @@
+#include "Platform.h"
+#include <thread>
+#include <string>
+#include <filesystem>
+#include <cstdlib>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+uint32_t Platform::GetLogicalCoreCount() {
+	uint32_t count = std::thread::hardware_concurrency();
+	return count == 0 ? 1 : count;
+}
+
+bool Platform::PinCurrentThreadToCore(uint32_t core) {
+#ifdef _WIN32
+	GROUP_AFFINITY affinity = {};
+	affinity.Group = (WORD)(core / 64);
+	affinity.Mask = (KAFFINITY)1 << (core % 64);
+	return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+uint32_t Platform::GetNumaNodeOfCore(uint32_t core) {
+#ifdef _WIN32
+	PROCESSOR_NUMBER processor = {};
+	processor.Group = (WORD)(core / 64);
+	processor.Number = (BYTE)(core % 64);
+	USHORT node = 0;
+	if (!GetNumaProcessorNodeEx(&processor, &node) || node == 0xFFFF)
+		return 0;
+	return node;
+#else
+	// The core's directory has a link to its node
+	std::error_code error;
+	std::filesystem::path coreDirectory = "/sys/devices/system/cpu/cpu" + std::to_string(core);
+	for (const auto& entry : std::filesystem::directory_iterator(coreDirectory, error)) {
+		std::string name = entry.path().filename().string();
+		if (name.rfind("node", 0) == 0)
+			return (uint32_t)std::atoi(name.c_str() + 4);
+	}
+	return 0;
+#endif
+}
+
+void* Platform::AllocateOnNumaNode(size_t size, [[maybe_unused]] uint32_t node) {
+#ifdef _WIN32
+	// ANY_NUMA_NODE is the same as NUMA_NO_PREFERRED_NODE
+	void* memory = VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+	if (memory == nullptr)
+		memory = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	return memory;
+#else
+	// Linux places pages on the node of the thread that first touches them, which is the calling thread
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return memory == MAP_FAILED ? nullptr : memory;
+#endif
+}
+
+void Platform::FreeNumaAllocation(void* memory, size_t size) {
+#ifdef _WIN32
+	VirtualFree(memory, 0, MEM_RELEASE);
+#else
+	munmap(memory, size);
+#endif
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Operating system specific helpers for the render threads
+namespace Platform {
+	constexpr uint32_t ANY_NUMA_NODE = 0xFFFFFFFF;
+
+	uint32_t GetLogicalCoreCount();
+
+	// Return: Did it succeed
+	bool PinCurrentThreadToCore(uint32_t core);
+
+	// Return: NUMA node of the core, 0 if it can't be found out
+	uint32_t GetNumaNodeOfCore(uint32_t core);
+
+	// Allocates memory from the NUMA node's own memory. Falls back to normal allocation. Return: nullptr if out of memory
+	void* AllocateOnNumaNode(size_t size, uint32_t node);
+	void FreeNumaAllocation(void* memory, size_t size);
+}
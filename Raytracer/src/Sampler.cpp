@@ -0,0 +1,338 @@
+#include "Sampler.h"
+
+#include <array>
+#include <gtx/compatibility.hpp>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+std::unique_ptr<Sampler> Sampler::Create() {
+	switch (SAMPLER) {
+		case 1: return std::make_unique<StratifiedSampler>();
+		case 2: return std::make_unique<SobolSampler>();
+		case 3: return std::make_unique<BlueNoiseSampler>();
+		default: return std::make_unique<IndependentSampler>();
+	}
+}
+
+void Sampler::StartFrame(uint32_t frame, uint32_t sampleCount) {
+	this->frame = frame;
+	this->sampleCount = glm::max(sampleCount, 1u);
+}
+void Sampler::StartSample(uint32_t pixel, uint32_t sampleIndex) {
+	this->pixel = pixel;
+	this->sampleIndex = sampleIndex;
+	pixelSeed = GetPathSeed(pixel, 0, frame);
+}
+
+void Sampler::Get2D(uint32_t dimension, const uint32_t* paths, uint32_t count, const uint32_t* pixels, const uint32_t* sampleIndices, glm::vec2* outSamples) {
+	for (uint32_t i = 0; i < count; i++) {
+		StartSample(pixels[paths[i]], sampleIndices[paths[i]]);
+		outSamples[i] = Get2D(dimension);
+	}
+}
+
+// Return: 0 to 1, without 1, from the highest 24 bits
+static inline float To01(uint32_t bits) {
+	return (float)(bits >> 8) / (1 << 24);
+}
+
+//////////////////////////////////
+///////////// Samplers ///////////
+//////////////////////////////////
+
+glm::vec2 IndependentSampler::Get2D(uint32_t dimension) {
+	Random random(GetSeed(dimension));
+	const float x = random.Next01();
+	return { x, random.Next01() };
+}
+
+void IndependentSampler::Get2D(uint32_t dimension, const uint32_t* paths, uint32_t count, const uint32_t* pixels, const uint32_t* sampleIndices, glm::vec2* outSamples) {
+	Random8 random;
+	alignas(32) float x[8], y[8];
+	for (uint32_t start = 0; start < count; start += 8) {
+		const uint32_t size = glm::min(count - start, 8u);
+		for (uint32_t lane = 0; lane < size; lane++) {
+			StartSample(pixels[paths[start + lane]], sampleIndices[paths[start + lane]]);
+			random.states[lane] = Random(GetSeed(dimension)).state;
+		}
+
+		random.Next01(x, (1 << size) - 1);
+		random.Next01(y, (1 << size) - 1);
+		for (uint32_t lane = 0; lane < size; lane++)
+			outSamples[start + lane] = { x[lane], y[lane] };
+	}
+}
+
+// A random permutation of 0 to length-1 for every seed, without storing it. By Andrew Kensler.
+static uint32_t PermuteIndex(uint32_t index, uint32_t length, uint32_t seed) {
+	uint32_t mask = length - 1;
+	mask |= mask >> 1;
+	mask |= mask >> 2;
+	mask |= mask >> 4;
+	mask |= mask >> 8;
+	mask |= mask >> 16;
+
+	// Indices past the length are cycled until they land inside it
+	do {
+		index ^= seed; index *= 0xe170893d;
+		index ^= seed >> 16;
+		index ^= (index & mask) >> 4;
+		index ^= seed >> 8; index *= 0x0929eb3f;
+		index ^= seed >> 23;
+		index ^= (index & mask) >> 1; index *= 1 | seed >> 27;
+		index *= 0x6935fa69;
+		index ^= (index & mask) >> 11; index *= 0x74dcb303;
+		index ^= (index & mask) >> 2; index *= 0x9e501cc3;
+		index ^= (index & mask) >> 2; index *= 0xc860a3df;
+		index &= mask;
+		index ^= index >> 5;
+	} while (index >= length);
+	return (index + seed) % length;
+}
+
+glm::vec2 StratifiedSampler::Get2D(uint32_t dimension) {
+	const uint32_t seed = GetPixelSeed(dimension);
+	const uint32_t index = sampleIndex % sampleCount;
+	const uint32_t cell = PermuteIndex(index, sampleCount, seed);
+	Random random(GetSeed(dimension));
+	const glm::vec2 jitter = { random.Next01(), random.Next01() };
+
+	const uint32_t axis = (uint32_t)glm::round(glm::sqrt((float)sampleCount));
+	if (axis * axis == sampleCount)
+		return (glm::vec2{ cell % axis, cell / axis } + jitter) / (float)axis;
+
+	// Each axis gets every one of sampleCount strips once, in their own orders
+	const uint32_t cellY = PermuteIndex(index, sampleCount, HashRandom(seed));
+	return glm::min((glm::vec2{ cell, cellY } + jitter) / (float)sampleCount, glm::vec2{ 0.99999994f });
+}
+
+static inline uint32_t ReverseBits(uint32_t v) {
+	v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+	v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+	v = ((v >> 4) & 0x0F0F0F0F) | ((v & 0x0F0F0F0F) << 4);
+	v = ((v >> 8) & 0x00FF00FF) | ((v & 0x00FF00FF) << 8);
+	return (v >> 16) | (v << 16);
+}
+
+// Hash by Laine and Karras that only lets lower bits change higher ones. On reversed bits that is Owen scrambling:
+// each bit is flipped based on the bits above it, so the points stay stratified.
+static inline uint32_t LaineKarras(uint32_t v, uint32_t seed) {
+	v += seed;
+	v ^= v * 0x6c50b47c;
+	v ^= v * 0xb82f1e52;
+	v ^= v * 0xc7afe638;
+	v ^= v * 0x8d22f6e6;
+	return v;
+}
+
+// The second dimension of Sobol with its bits reversed. The first is the bits of the index reversed.
+// Each bit of the index flips a direction, so a byte of it flips the same bits every time and can be looked up.
+static uint32_t ReversedSobolSecond(uint32_t index) {
+	static const std::array<std::array<uint32_t, 256>, 4> byteTables = [] {
+		std::array<std::array<uint32_t, 256>, 4> tables;
+		std::array<uint32_t, 32> directions;
+		directions[0] = 1;
+		for (int bit = 1; bit < 32; bit++)
+			directions[bit] = directions[bit - 1] ^ (directions[bit - 1] << 1);
+
+		for (int byte = 0; byte < 4; byte++) {
+			for (uint32_t value = 0; value < 256; value++) {
+				tables[byte][value] = 0;
+				for (int bit = 0; bit < 8; bit++) {
+					if (value & (1 << bit))
+						tables[byte][value] ^= directions[byte * 8 + bit];
+				}
+			}
+		}
+		return tables;
+	}();
+
+	return byteTables[0][index & 0xFF] ^ byteTables[1][(index >> 8) & 0xFF] ^ byteTables[2][(index >> 16) & 0xFF] ^ byteTables[3][index >> 24];
+}
+
+glm::vec2 SobolSampler::Get2D(uint32_t dimension) {
+	// Scrambling the index too gives every pixel and dimension its own order of the points.
+	// Everything is done on reversed bits, where scrambling is one hash.
+	const uint32_t seed = GetPixelSeed(dimension);
+	const uint32_t index = ReverseBits(LaineKarras(ReverseBits(sampleIndex), seed));
+	const uint32_t x = LaineKarras(index, HashRandom(seed ^ 0x1));
+	const uint32_t y = LaineKarras(ReversedSobolSecond(index), HashRandom(seed ^ 0x2));
+	return { To01(ReverseBits(x)), To01(ReverseBits(y)) };
+}
+
+// Return: The bits of the value with a zero between each, for the lowest 16 bits
+static inline uint32_t SpreadBits(uint32_t v) {
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	return (v | (v << 1)) & 0x55555555;
+}
+
+glm::vec2 BlueNoiseSampler::Get2D(uint32_t dimension) {
+	// The pixel is in the high bits of the index, so the pixels along the curve take blocks of the same sequence one after another.
+	// Any aligned group of pixels then has a whole block of the sequence between them, which is stratified.
+	// A block has room for the samples of a pass. Samples past it, from the next passes, get a new scramble.
+	const uint32_t sampleBits = glm::min((uint32_t)glm::ceil(glm::log2((float)sampleCount)), 10u);
+	static_assert(WINDOW_WIDTH <= 2048 && WINDOW_HEIGHT <= 2048, "The Z-order index of a pixel has to fit in 22 bits");
+	const uint32_t curveIndex = SpreadBits(pixel % WINDOW_WIDTH) | (SpreadBits(pixel / WINDOW_WIDTH) << 1);
+	const uint32_t sequenceIndex = (curveIndex << sampleBits) | (sampleIndex & ((1 << sampleBits) - 1));
+
+	// The same scrambling as SobolSampler, but one seed for the whole window. Scrambling the index shuffles the curve
+	// at every level, and every dimension has its own seed, so the dimensions don't predict each other.
+	const uint32_t seed = HashRandom(dimension ^ HashRandom(frame ^ HashRandom(sampleIndex >> sampleBits)));
+	const uint32_t index = ReverseBits(LaineKarras(ReverseBits(sequenceIndex), seed));
+	const uint32_t x = LaineKarras(index, HashRandom(seed ^ 0x1));
+	const uint32_t y = LaineKarras(ReversedSobolSecond(index), HashRandom(seed ^ 0x2));
+	return { To01(ReverseBits(x)), To01(ReverseBits(y)) };
+}
+
+//////////////////////////////////
+////////////// Warps /////////////
+//////////////////////////////////
+
+// Sine and cosine from Taylor series, the error is below 3e-7 from -pi/4 to pi/4
+static inline void GetSmallSineCosine(float angle, float& outSine, float& outCosine) {
+	const float angle2 = angle * angle;
+	outSine = angle * (1.0f + angle2 * (-1.0f / 6 + angle2 * (1.0f / 120 + angle2 * (-1.0f / 5040))));
+	outCosine = 1.0f + angle2 * (-1.0f / 2 + angle2 * (1.0f / 24 + angle2 * (-1.0f / 720 + angle2 * (1.0f / 40320))));
+}
+
+// Concentric mapping by Shirley and Chiu. Squares map to rings, so close samples stay close.
+// The angle is from -pi/4 to pi/4 measured from the axis the point is furthest along.
+// Return: The point, and 1 - its distance squared. Near the edge that is more accurate than calculating it from the point.
+static inline glm::vec2 GetConcentricDiskPoint(glm::vec2 sample, float& outOneMinusRadiusSquared) {
+	const glm::vec2 centered = sample * 2.0f - 1.0f;
+	const bool xBigger = glm::abs(centered.x) > glm::abs(centered.y);
+	const float radius = xBigger ? centered.x : centered.y;
+	const float angle = radius == 0 ? 0 : glm::pi<float>() / 4 * (xBigger ? centered.y / centered.x : centered.x / centered.y);
+
+	float sine, cosine;
+	GetSmallSineCosine(angle, sine, cosine);
+	outOneMinusRadiusSquared = (1.0f - glm::abs(radius)) * (1.0f + glm::abs(radius));
+	return radius * (xBigger ? glm::vec2{ cosine, sine } : glm::vec2{ sine, cosine });
+}
+
+glm::vec2 SampleUnitDisk(glm::vec2 sample) {
+	float oneMinusRadiusSquared;
+	return GetConcentricDiskPoint(sample, oneMinusRadiusSquared);
+}
+
+// The disk's radius squared is spread evenly from 0 to 1, so it can be the height on the sphere
+glm::vec3 SampleUnitSphere(glm::vec2 sample) {
+	float oneMinusRadiusSquared;
+	const glm::vec2 disk = GetConcentricDiskPoint(sample, oneMinusRadiusSquared);
+	return { disk * 2.0f * glm::sqrt(oneMinusRadiusSquared), 2.0f * oneMinusRadiusSquared - 1.0f };
+}
+
+// Two axes at right angles to the normal and each other, by Duff et al., without branches or divisions by zero
+static inline void GetTangents(const glm::vec3& normal, glm::vec3& outTangent, glm::vec3& outBitangent) {
+	const float sign = normal.z >= 0 ? 1.0f : -1.0f;
+	const float a = -1.0f / (sign + normal.z);
+	const float b = normal.x * normal.y * a;
+	outTangent = { 1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x };
+	outBitangent = { b, sign + normal.y * normal.y * a, -normal.y };
+}
+
+// Projects the disk up to the hemisphere around the normal, by Malley
+static inline glm::vec3 DiskToCosineHemisphere(glm::vec2 disk, float oneMinusRadiusSquared, const glm::vec3& normal) {
+	glm::vec3 tangent, bitangent;
+	GetTangents(normal, tangent, bitangent);
+	return tangent * disk.x + bitangent * disk.y + normal * glm::sqrt(oneMinusRadiusSquared);
+}
+
+glm::vec3 SampleCosineHemisphere(glm::vec2 sample, const glm::vec3& normal) {
+	float oneMinusRadiusSquared;
+	const glm::vec2 disk = GetConcentricDiskPoint(sample, oneMinusRadiusSquared);
+	return DiskToCosineHemisphere(disk, oneMinusRadiusSquared, normal);
+}
+
+// The disk's radius squared is spread evenly from 0 to 1, so it can be the height of the cap
+glm::vec3 SampleCone(glm::vec2 sample, const glm::vec3& axis, float oneMinusCosThetaMax) {
+	float oneMinusRadiusSquared;
+	const glm::vec2 disk = GetConcentricDiskPoint(sample, oneMinusRadiusSquared);
+	const float radiusSquared = glm::dot(disk, disk);
+	const float oneMinusCosTheta = radiusSquared * oneMinusCosThetaMax;
+	const float sinTheta = glm::sqrt(glm::max(oneMinusCosTheta * (2.0f - oneMinusCosTheta), 0.0f));
+	const float diskRadius = glm::sqrt(radiusSquared);
+
+	glm::vec3 tangent, bitangent;
+	GetTangents(axis, tangent, bitangent);
+	const glm::vec2 onCircle = diskRadius > 0 ? disk * (sinTheta / diskRadius) : glm::vec2{ 0 };
+	return tangent * onCircle.x + bitangent * onCircle.y + axis * (1.0f - oneMinusCosTheta);
+}
+
+#if defined(__AVX2__)
+// GetConcentricDiskPoint for eight samples
+static inline void GetConcentricDiskPoints8(const glm::vec2* samples, __m256& outX, __m256& outY, __m256& outOneMinusRadiusSquared) {
+	alignas(32) float sampleX[8], sampleY[8];
+	for (int lane = 0; lane < 8; lane++) {
+		sampleX[lane] = samples[lane].x;
+		sampleY[lane] = samples[lane].y;
+	}
+
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	const __m256 x = _mm256_sub_ps(_mm256_mul_ps(_mm256_load_ps(sampleX), _mm256_set1_ps(2.0f)), one);
+	const __m256 y = _mm256_sub_ps(_mm256_mul_ps(_mm256_load_ps(sampleY), _mm256_set1_ps(2.0f)), one);
+	const __m256 xBigger = _mm256_cmp_ps(_mm256_and_ps(x, absMask), _mm256_and_ps(y, absMask), _CMP_GT_OQ);
+	const __m256 radius = _mm256_blendv_ps(y, x, xBigger);
+	const __m256 other = _mm256_blendv_ps(x, y, xBigger);
+	const __m256 isZero = _mm256_cmp_ps(radius, _mm256_setzero_ps(), _CMP_EQ_OQ);
+	const __m256 angle = _mm256_andnot_ps(isZero, _mm256_mul_ps(_mm256_set1_ps(glm::pi<float>() / 4), _mm256_div_ps(other, radius)));
+
+	const __m256 angle2 = _mm256_mul_ps(angle, angle);
+	__m256 sine = _mm256_fmadd_ps(angle2, _mm256_set1_ps(-1.0f / 5040), _mm256_set1_ps(1.0f / 120));
+	sine = _mm256_fmadd_ps(angle2, sine, _mm256_set1_ps(-1.0f / 6));
+	sine = _mm256_mul_ps(angle, _mm256_fmadd_ps(angle2, sine, one));
+	__m256 cosine = _mm256_fmadd_ps(angle2, _mm256_set1_ps(1.0f / 40320), _mm256_set1_ps(-1.0f / 720));
+	cosine = _mm256_fmadd_ps(angle2, cosine, _mm256_set1_ps(1.0f / 24));
+	cosine = _mm256_fmadd_ps(angle2, cosine, _mm256_set1_ps(-1.0f / 2));
+	cosine = _mm256_fmadd_ps(angle2, cosine, one);
+
+	const __m256 absRadius = _mm256_and_ps(radius, absMask);
+	outOneMinusRadiusSquared = _mm256_mul_ps(_mm256_sub_ps(one, absRadius), _mm256_add_ps(one, absRadius));
+	outX = _mm256_mul_ps(radius, _mm256_blendv_ps(sine, cosine, xBigger));
+	outY = _mm256_mul_ps(radius, _mm256_blendv_ps(cosine, sine, xBigger));
+}
+#endif
+
+void SampleUnitSpheres(const glm::vec2* samples, uint32_t count, glm::vec3* outDirections) {
+	uint32_t i = 0;
+#if defined(__AVX2__)
+	alignas(32) float x[8], y[8], z[8];
+	for (; i + 8 <= count; i += 8) {
+		__m256 diskX, diskY, oneMinusRadiusSquared;
+		GetConcentricDiskPoints8(&samples[i], diskX, diskY, oneMinusRadiusSquared);
+		const __m256 scale = _mm256_mul_ps(_mm256_set1_ps(2.0f), _mm256_sqrt_ps(oneMinusRadiusSquared));
+		_mm256_store_ps(x, _mm256_mul_ps(diskX, scale));
+		_mm256_store_ps(y, _mm256_mul_ps(diskY, scale));
+		_mm256_store_ps(z, _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), oneMinusRadiusSquared), _mm256_set1_ps(1.0f)));
+		for (int lane = 0; lane < 8; lane++)
+			outDirections[i + lane] = { x[lane], y[lane], z[lane] };
+	}
+#endif
+	for (; i < count; i++)
+		outDirections[i] = SampleUnitSphere(samples[i]);
+}
+
+void SampleCosineHemispheres(const glm::vec2* samples, const glm::vec3* normals, uint32_t count, glm::vec3* outDirections) {
+	uint32_t i = 0;
+#if defined(__AVX2__)
+	// Only the disk is wide, the normals are stored one by one so turning them into axes stays scalar
+	alignas(32) float diskX[8], diskY[8], oneMinusRadiusSquared[8];
+	for (; i + 8 <= count; i += 8) {
+		__m256 x, y, height;
+		GetConcentricDiskPoints8(&samples[i], x, y, height);
+		_mm256_store_ps(diskX, x);
+		_mm256_store_ps(diskY, y);
+		_mm256_store_ps(oneMinusRadiusSquared, height);
+		for (int lane = 0; lane < 8; lane++)
+			outDirections[i + lane] = DiskToCosineHemisphere({ diskX[lane], diskY[lane] }, oneMinusRadiusSquared[lane], normals[i + lane]);
+	}
+#endif
+	for (; i < count; i++)
+		outDirections[i] = SampleCosineHemisphere(samples[i], normals[i]);
+}
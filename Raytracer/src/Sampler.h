@@ -0,0 +1,95 @@
+#pragma once
+#include "Constants.h"
+#include "DataUtility.h"
+
+#include <memory>
+#include <glm.hpp>
+
+// The dimensions of a sample. Each is its own stream of numbers, so they don't correlate with each other.
+constexpr uint32_t PIXEL_DIMENSION = 0; // Place inside the pixel
+constexpr uint32_t LENS_DIMENSION = 1;  // Place on the lens, for depth of field
+// Every bounce has a group of dimensions. The first bounce is the hit of the camera ray.
+enum class BounceDimension {
+	Direction, Light, LightChoice, Fog, Shadow, RussianRoulette, Count
+};
+inline uint32_t GetBounceDimension(int bounce, BounceDimension dimension) { return 2 + bounce * (uint32_t)BounceDimension::Count + (uint32_t)dimension; }
+
+// Gives the numbers of the samples of a pixel. The numbers only depend on the pixel, sample, frame and dimension,
+// so the samplers spread the samples of a pixel evenly instead of the clumps and holes of independent random numbers.
+class Sampler {
+public:
+	virtual ~Sampler() = default;
+	static std::unique_ptr<Sampler> Create(); // Of the type set by SAMPLER
+
+	// Every pixel gets sampleCount samples on this frame
+	void StartFrame(uint32_t frame, uint32_t sampleCount);
+	void StartSample(uint32_t pixel, uint32_t sampleIndex);
+
+	// Return: Two numbers from 0 to 1, without 1
+	virtual glm::vec2 Get2D(uint32_t dimension) = 0;
+	float Get1D(uint32_t dimension) { return Get2D(dimension).x; }
+	// Get2D for many samples at once. The samples are the pixels and sampleIndices of the paths
+	virtual void Get2D(uint32_t dimension, const uint32_t* paths, uint32_t count, const uint32_t* pixels, const uint32_t* sampleIndices, glm::vec2* outSamples);
+
+	// Return: A seed for the numbers of code that needs a whole generator. Different for every sample and dimension
+	uint32_t GetSeed(uint32_t dimension) const { return HashRandom(GetPixelSeed(dimension) ^ HashRandom(sampleIndex)); }
+
+protected:
+	// Return: The same for all the samples of the pixel
+	uint32_t GetPixelSeed(uint32_t dimension) const { return HashRandom(pixelSeed ^ HashRandom(dimension)); }
+
+	uint32_t frame = 0;
+	uint32_t sampleCount = 1;
+	uint32_t pixel = 0;
+	uint32_t sampleIndex = 0;
+	uint32_t pixelSeed = 0;
+};
+
+// White noise, every number is independent
+class IndependentSampler : public Sampler {
+public:
+	using Sampler::Get2D;
+	glm::vec2 Get2D(uint32_t dimension) override;
+	// Eight samples at a time with Random8
+	void Get2D(uint32_t dimension, const uint32_t* paths, uint32_t count, const uint32_t* pixels, const uint32_t* sampleIndices, glm::vec2* outSamples) override;
+};
+
+// Jittered grid when the sample count is a square, otherwise a Latin hypercube.
+// The samples get the cells in a different order in every dimension.
+class StratifiedSampler : public Sampler {
+public:
+	using Sampler::Get2D;
+	glm::vec2 Get2D(uint32_t dimension) override;
+};
+
+// The first two dimensions of Sobol with hash based Owen scrambling and shuffling, by Brent Burley.
+// Every dimension has its own scramble, so they stay decorrelated. Good for any sample count.
+class SobolSampler : public Sampler {
+public:
+	using Sampler::Get2D;
+	glm::vec2 Get2D(uint32_t dimension) override;
+};
+
+// One Owen scrambled Sobol sequence for the whole window, the pixels take its points in Z-order, by Ahmed and Wonka.
+// Neighbouring pixels get points that fill each other's gaps, so the error shows up as fine grain instead of blotches.
+class BlueNoiseSampler : public Sampler {
+public:
+	using Sampler::Get2D;
+	glm::vec2 Get2D(uint32_t dimension) override;
+};
+
+// Warps that turn samples from 0 to 1 into points and directions. They are closed form, so every sample is used
+// and samples that are spread evenly stay spread evenly. The pdfs are per area of the disk or per solid angle.
+glm::vec2 SampleUnitDisk(glm::vec2 sample);
+glm::vec3 SampleUnitSphere(glm::vec2 sample);
+// Return: A direction on the side of the normal, more likely close to it. Lambertian surfaces reflect like this.
+glm::vec3 SampleCosineHemisphere(glm::vec2 sample, const glm::vec3& normal);
+inline float GetUnitDiskPdf() { return 1.0f / glm::pi<float>(); }
+inline float GetUnitSpherePdf() { return 1.0f / (4.0f * glm::pi<float>()); }
+inline float GetCosineHemispherePdf(float cosTheta) { return glm::max(cosTheta, 0.0f) / glm::pi<float>(); }
+// Return: A direction at most thetaMax from the axis, every one as likely. Takes 1 - cos(thetaMax), which stays exact for small cones.
+glm::vec3 SampleCone(glm::vec2 sample, const glm::vec3& axis, float oneMinusCosThetaMax);
+inline float GetConePdf(float oneMinusCosThetaMax) { return 1.0f / (2.0f * glm::pi<float>() * oneMinusCosThetaMax); }
+// The same for many samples, eight at a time with AVX2
+void SampleUnitSpheres(const glm::vec2* samples, uint32_t count, glm::vec3* outDirections);
+void SampleCosineHemispheres(const glm::vec2* samples, const glm::vec3* normals, uint32_t count, glm::vec3* outDirections);
@@ -0,0 +1,148 @@
+#include "SignedDistanceField.h"
+#include <iostream>
+#include <gtc/constants.hpp>
+
+float SDFRoundedBox::GetDistance(const glm::vec3& p) const {
+	glm::vec3 q = glm::abs(p - pos) - (halfSize - rounding);
+	return glm::length(glm::max(q, 0.0f)) + glm::min(glm::max(q.x, glm::max(q.y, q.z)), 0.0f) - rounding;
+}
+
+float SDFTorus::GetDistance(const glm::vec3& p) const {
+	glm::vec3 local = p - pos;
+	glm::vec2 q = glm::vec2(glm::length(glm::vec2(local.x, local.z)) - majorRadius, local.y);
+	return glm::length(q) - minorRadius;
+}
+BoundingBox SDFTorus::GetBounds() const {
+	glm::vec3 extents = { majorRadius + minorRadius, minorRadius, majorRadius + minorRadius };
+	return BoundingBox(pos - extents, pos + extents);
+}
+
+// Polynomial smooth minimum by Inigo Quilez
+float SDFSmoothUnion::GetDistance(const glm::vec3& p) const {
+	float distA = a->GetDistance(p);
+	float distB = b->GetDistance(p);
+	float h = glm::clamp(0.5f + 0.5f * (distB - distA) / smoothness, 0.0f, 1.0f);
+	return glm::mix(distB, distA, h) - smoothness * h * (1.0f - h);
+}
+BoundingBox SDFSmoothUnion::GetBounds() const {
+	BoundingBox boxA = a->GetBounds();
+	BoundingBox boxB = b->GetBounds();
+
+	// The blend can bulge out of the original shapes by a quarter of the smoothness
+	float padding = smoothness * 0.25f;
+	return BoundingBox(glm::min(boxA.minCoord, boxB.minCoord) - padding, glm::max(boxA.maxCoord, boxB.maxCoord) + padding);
+}
+
+SDFBrickGrid::SDFBrickGrid(const DistanceFunction& source, float voxelSize) : voxelSize(voxelSize) {
+	BoundingBox sourceBounds = source.GetBounds();
+	brickSize = voxelSize * BRICK_CELLS;
+	quantizationRange = voxelSize * 2.0f;
+
+	// Leave a little room around the shape so the surface never touches the grid border
+	bounds.minCoord = sourceBounds.minCoord - voxelSize * 2.0f;
+	brickCount = glm::ivec3(glm::ceil((sourceBounds.maxCoord + voxelSize * 2.0f - bounds.minCoord) / brickSize));
+	bounds.maxCoord = bounds.minCoord + glm::vec3(brickCount) * brickSize;
+
+	const float halfDiagonal = brickSize * glm::root_three<float>() * 0.5f;
+	const int samplesPerBrick = BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES;
+
+	cells.resize((size_t)brickCount.x * brickCount.y * brickCount.z);
+	for (int z = 0; z < brickCount.z; z++) {
+		for (int y = 0; y < brickCount.y; y++) {
+			for (int x = 0; x < brickCount.x; x++) {
+				BrickCell& cell = cells[((size_t)z * brickCount.y + y) * brickCount.x + x];
+				glm::vec3 brickMin = bounds.minCoord + glm::vec3(x, y, z) * brickSize;
+				float centerDistance = source.GetDistance(brickMin + brickSize * 0.5f);
+
+				// Nothing of the surface can be inside this brick
+				if (glm::abs(centerDistance) > halfDiagonal + voxelSize) {
+					cell.brickIndex = -1;
+					cell.conservativeDistance = glm::sign(centerDistance) * (glm::abs(centerDistance) - halfDiagonal);
+					continue;
+				}
+
+				cell.brickIndex = (int32_t)(brickPool.size() / samplesPerBrick);
+				cell.conservativeDistance = 0.0f;
+				for (int k = 0; k < BRICK_SAMPLES; k++) {
+					for (int j = 0; j < BRICK_SAMPLES; j++) {
+						for (int i = 0; i < BRICK_SAMPLES; i++) {
+							float distance = source.GetDistance(brickMin + glm::vec3(i, j, k) * voxelSize);
+							float normalized = glm::clamp(distance / quantizationRange, -1.0f, 1.0f) * 0.5f + 0.5f;
+							brickPool.push_back((uint8_t)(normalized * 255.0f + 0.5f));
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+inline float SDFBrickGrid::GetPoolSample(int32_t brickIndex, int x, int y, int z) const {
+	size_t index = (size_t)brickIndex * BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES + (z * BRICK_SAMPLES + y) * BRICK_SAMPLES + x;
+	return ((float)brickPool[index] / 255.0f * 2.0f - 1.0f) * quantizationRange;
+}
+
+float SDFBrickGrid::GetDistance(const glm::vec3& p) const {
+	// Points outside of the grid get the distance to the grid added
+	glm::vec3 clamped = glm::clamp(p, bounds.minCoord, bounds.maxCoord);
+	float outsideDistance = glm::length(p - clamped);
+
+	glm::vec3 brickSpace = (clamped - bounds.minCoord) / brickSize;
+	glm::ivec3 brick = glm::clamp(glm::ivec3(brickSpace), glm::ivec3(0), brickCount - 1);
+	const BrickCell& cell = cells[((size_t)brick.z * brickCount.y + brick.y) * brickCount.x + brick.x];
+	if (cell.brickIndex < 0)
+		return cell.conservativeDistance + outsideDistance;
+
+	glm::vec3 cellSpace = (brickSpace - glm::vec3(brick)) * (float)BRICK_CELLS;
+	glm::ivec3 i = glm::clamp(glm::ivec3(cellSpace), glm::ivec3(0), glm::ivec3(BRICK_CELLS - 1));
+	glm::vec3 t = cellSpace - glm::vec3(i);
+
+	float c00 = glm::mix(GetPoolSample(cell.brickIndex, i.x, i.y,     i.z),     GetPoolSample(cell.brickIndex, i.x + 1, i.y,     i.z),     t.x);
+	float c10 = glm::mix(GetPoolSample(cell.brickIndex, i.x, i.y + 1, i.z),     GetPoolSample(cell.brickIndex, i.x + 1, i.y + 1, i.z),     t.x);
+	float c01 = glm::mix(GetPoolSample(cell.brickIndex, i.x, i.y,     i.z + 1), GetPoolSample(cell.brickIndex, i.x + 1, i.y,     i.z + 1), t.x);
+	float c11 = glm::mix(GetPoolSample(cell.brickIndex, i.x, i.y + 1, i.z + 1), GetPoolSample(cell.brickIndex, i.x + 1, i.y + 1, i.z + 1), t.x);
+	return glm::mix(glm::mix(c00, c10, t.y), glm::mix(c01, c11, t.y), t.z) + outsideDistance;
+}
+
+bool SDFObject::Intersect(const Ray& ray, HitInfo& hitInfo) const {
+	const int maxSteps = 128;
+	const float hitEpsilon = 0.001f;
+
+	float tmin, tmax;
+	if (!box.GetRayHitDistances(ray, tmin, tmax))
+		return false;
+
+	float t = glm::max(tmin, 0.0f);
+	for (int i = 0; i < maxSteps && t <= tmax; i++) {
+		glm::vec3 p = ray.pos + ray.direction * t;
+		float distance = function->GetDistance(p);
+
+		// Allow a bit more error further away, there's no visible difference
+		if (distance < hitEpsilon * glm::max(1.0f, t)) {
+			hitInfo.distance = t;
+			hitInfo.normal = CalculateNormal(p);
+			hitInfo.object = (Object*)this;
+			hitInfo.point = p + hitInfo.normal * 0.01f;
+			hitInfo.uv = glm::vec2(glm::atan(hitInfo.normal.x, hitInfo.normal.z) / (2 * glm::pi<float>()) + 0.5f, hitInfo.normal.y * 0.5f + 0.5f);
+			return true;
+		}
+
+		t += distance;
+	}
+
+	return false;
+}
+
+// Tetrahedron technique, only needs four distance evaluations
+glm::vec3 SDFObject::CalculateNormal(const glm::vec3& p) const {
+	const float h = function->GetGradientStep();
+	const glm::vec3 k1 = {  1, -1, -1 };
+	const glm::vec3 k2 = { -1, -1,  1 };
+	const glm::vec3 k3 = { -1,  1, -1 };
+	const glm::vec3 k4 = {  1,  1,  1 };
+
+	return glm::normalize(k1 * function->GetDistance(p + k1 * h) +
+						  k2 * function->GetDistance(p + k2 * h) +
+						  k3 * function->GetDistance(p + k3 * h) +
+						  k4 * function->GetDistance(p + k4 * h));
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include "Object.h"
+
+#include <vector>
+#include <memory>
+
+// Anything that can tell the distance to its closest surface. Distances are negative inside the shape.
+struct DistanceFunction {
+	virtual ~DistanceFunction() = default;
+
+	virtual float GetDistance(const glm::vec3& p) const = 0;
+	virtual BoundingBox GetBounds() const = 0;
+
+	// How far apart the samples for calculating the normal should be
+	virtual float GetGradientStep() const { return 0.0005f; }
+};
+
+struct SDFSphere : public DistanceFunction {
+	SDFSphere(glm::vec3 pos, float radius) : pos(pos), radius(radius) {}
+
+	float GetDistance(const glm::vec3& p) const override { return glm::length(p - pos) - radius; }
+	BoundingBox GetBounds() const override { return BoundingBox(pos - radius, pos + radius); }
+
+	glm::vec3 pos{ 0 };
+	float radius = 0;
+};
+
+struct SDFRoundedBox : public DistanceFunction {
+	SDFRoundedBox(glm::vec3 pos, glm::vec3 halfSize, float rounding) : pos(pos), halfSize(halfSize), rounding(rounding) {}
+
+	float GetDistance(const glm::vec3& p) const override;
+	BoundingBox GetBounds() const override { return BoundingBox(pos - halfSize, pos + halfSize); }
+
+	glm::vec3 pos{ 0 };
+	glm::vec3 halfSize{ 1 };
+	float rounding = 0;
+};
+
+// Lies on the XZ-plane. Rotate it with the Apply*Rotation objects if needed.
+struct SDFTorus : public DistanceFunction {
+	SDFTorus(glm::vec3 pos, float majorRadius, float minorRadius) : pos(pos), majorRadius(majorRadius), minorRadius(minorRadius) {}
+
+	float GetDistance(const glm::vec3& p) const override;
+	BoundingBox GetBounds() const override;
+
+	glm::vec3 pos{ 0 };
+	float majorRadius = 1;
+	float minorRadius = 0.25f;
+};
+
+// Blends two shapes together. Smoothness is roughly the distance where the blending happens.
+struct SDFSmoothUnion : public DistanceFunction {
+	SDFSmoothUnion(std::shared_ptr<DistanceFunction> a, std::shared_ptr<DistanceFunction> b, float smoothness) : a(a), b(b), smoothness(smoothness) {}
+
+	float GetDistance(const glm::vec3& p) const override;
+	BoundingBox GetBounds() const override;
+
+	std::shared_ptr<DistanceFunction> a;
+	std::shared_ptr<DistanceFunction> b;
+	float smoothness = 0.5f;
+};
+
+// A distance function baked to a grid. Only the bricks near the surface store samples, the rest
+// of the grid only knows a conservative distance to the surface, so empty space costs 8 bytes per brick.
+// Bricks are BRICK_CELLS^3 cells with their borders duplicated, so trilinear sampling never leaves a brick.
+struct SDFBrickGrid : public DistanceFunction {
+	static constexpr int BRICK_CELLS = 8;
+	static constexpr int BRICK_SAMPLES = BRICK_CELLS + 1;
+
+	SDFBrickGrid(const DistanceFunction& source, float voxelSize);
+
+	float GetDistance(const glm::vec3& p) const override;
+	BoundingBox GetBounds() const override { return bounds; }
+	float GetGradientStep() const override { return voxelSize * 0.5f; }
+
+	size_t GetMemoryUsage() const { return brickPool.size() + cells.size() * sizeof(BrickCell); }
+
+private:
+	struct BrickCell {
+		int32_t brickIndex = -1;     // -1 if the brick is empty
+		float conservativeDistance;  // Used when the brick is empty
+	};
+
+	inline float GetPoolSample(int32_t brickIndex, int x, int y, int z) const;
+
+	BoundingBox bounds;
+	glm::ivec3 brickCount;
+	float voxelSize;
+	float brickSize;
+	float quantizationRange; // Stored samples are clamped to +-this. Clamping only underestimates, so tracing stays safe
+
+	std::vector<BrickCell> cells;
+	std::vector<uint8_t> brickPool;
+};
+
+// Intersected by sphere tracing the distance function inside its bounding box
+struct SDFObject : public Object {
+	SDFObject(std::shared_ptr<DistanceFunction> function, Material mat)
+		: Object(mat), function(function), box(function->GetBounds()) {}
+
+	bool Intersect(const Ray& ray, HitInfo& hitInfo) const override;
+	bool GetBoundingBox(BoundingBox& outBox) const override { outBox = box; return true; }
+
+	std::shared_ptr<DistanceFunction> function;
+	BoundingBox box;
+
+private:
+	glm::vec3 CalculateNormal(const glm::vec3& p) const;
+};
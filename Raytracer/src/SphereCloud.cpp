@@ -0,0 +1,239 @@
+#include "SphereCloud.h"
+#include <algorithm>
+#include <numeric>
+#include <gtc/constants.hpp>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+SphereCloud::SphereCloud(const std::vector<glm::vec4>& spheres, const std::vector<uint8_t>& materialIndices, const std::vector<Material>& materials)
+	: materials(materials)
+{
+	std::vector<uint32_t> order(spheres.size());
+	std::iota(order.begin(), order.end(), 0);
+
+	nodes.reserve(2 * spheres.size() / LEAF_SIZE + 1);
+	if (!spheres.empty())
+		BuildNode(order, 0, (uint32_t)spheres.size(), spheres);
+
+	// Store the spheres in the order the leaves reference them
+	centerX.resize(spheres.size() + LEAF_SIZE, 0.0f);
+	centerY.resize(spheres.size() + LEAF_SIZE, 0.0f);
+	centerZ.resize(spheres.size() + LEAF_SIZE, 0.0f);
+	radius.resize(spheres.size() + LEAF_SIZE, 0.0f);
+	this->materialIndices.resize(spheres.size());
+	for (size_t i = 0; i < spheres.size(); i++) {
+		const glm::vec4& sphere = spheres[order[i]];
+		centerX[i] = sphere.x;
+		centerY[i] = sphere.y;
+		centerZ[i] = sphere.z;
+		radius[i] = sphere.w;
+		this->materialIndices[i] = materialIndices[order[i]];
+	}
+}
+
+uint32_t SphereCloud::BuildNode(std::vector<uint32_t>& order, uint32_t start, uint32_t end, const std::vector<glm::vec4>& spheres) {
+	uint32_t index = (uint32_t)nodes.size();
+	nodes.push_back(Node());
+
+	BoundingBox box = BoundingBox(glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max()));
+	BoundingBox centerBox = box;
+	for (uint32_t i = start; i < end; i++) {
+		glm::vec3 center = glm::vec3(spheres[order[i]]);
+		float sphereRadius = spheres[order[i]].w;
+		box.minCoord = glm::min(box.minCoord, center - sphereRadius);
+		box.maxCoord = glm::max(box.maxCoord, center + sphereRadius);
+		centerBox.minCoord = glm::min(centerBox.minCoord, center);
+		centerBox.maxCoord = glm::max(centerBox.maxCoord, center);
+	}
+
+	if (end - start <= LEAF_SIZE) {
+		nodes[index] = Node{ box, start, end - start };
+		return index;
+	}
+
+	// Split from the median of the longest axis
+	glm::vec3 extents = centerBox.maxCoord - centerBox.minCoord;
+	int axis = (extents.x > extents.y && extents.x > extents.z) ? 0 : (extents.y > extents.z ? 1 : 2);
+	uint32_t mid = start + (end - start) / 2;
+	std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+		[&spheres, axis](uint32_t a, uint32_t b) { return spheres[a][axis] < spheres[b][axis]; });
+
+	BuildNode(order, start, mid, spheres);
+	uint32_t right = BuildNode(order, mid, end, spheres);
+	nodes[index] = Node{ box, right, 0 };
+	return index;
+}
+
+// Return: Does the ray enter the box before maxDistance
+static inline bool GetBoxEntryDistance(const BoundingBox& box, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance, float& outEntry) {
+	glm::vec3 t0 = (box.minCoord - origin) * inverseDirection;
+	glm::vec3 t1 = (box.maxCoord - origin) * inverseDirection;
+	glm::vec3 tSmaller = glm::min(t0, t1);
+	glm::vec3 tBigger = glm::max(t0, t1);
+
+	outEntry = glm::max(glm::max(tSmaller.x, tSmaller.y), glm::max(tSmaller.z, 0.0f));
+	float exit = glm::min(glm::min(tBigger.x, tBigger.y), glm::min(tBigger.z, maxDistance));
+	return outEntry <= exit;
+}
+
+inline int SphereCloud::IntersectLeaf(const Ray& ray, const Node& leaf, float& closestDistance) const {
+#if defined(__AVX__)
+	const uint32_t s = leaf.start;
+	__m256 offsetX = _mm256_sub_ps(_mm256_set1_ps(ray.pos.x), _mm256_loadu_ps(&centerX[s]));
+	__m256 offsetY = _mm256_sub_ps(_mm256_set1_ps(ray.pos.y), _mm256_loadu_ps(&centerY[s]));
+	__m256 offsetZ = _mm256_sub_ps(_mm256_set1_ps(ray.pos.z), _mm256_loadu_ps(&centerZ[s]));
+	__m256 r = _mm256_loadu_ps(&radius[s]);
+
+	// Same as Sphere::Intersect, for 8 spheres
+	__m256 b = _mm256_add_ps(_mm256_add_ps(
+		_mm256_mul_ps(_mm256_set1_ps(ray.direction.x), offsetX),
+		_mm256_mul_ps(_mm256_set1_ps(ray.direction.y), offsetY)),
+		_mm256_mul_ps(_mm256_set1_ps(ray.direction.z), offsetZ));
+	__m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(
+		_mm256_mul_ps(offsetX, offsetX),
+		_mm256_mul_ps(offsetY, offsetY)),
+		_mm256_mul_ps(offsetZ, offsetZ)),
+		_mm256_mul_ps(r, r));
+	__m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b), c);
+	__m256 t = _mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), b), _mm256_sqrt_ps(_mm256_max_ps(discriminant, _mm256_setzero_ps())));
+
+	__m256 lanes = _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0);
+	__m256 mask = _mm256_and_ps(
+		_mm256_and_ps(_mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_GE_OQ)),
+		_mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(closestDistance), _CMP_LT_OQ), _mm256_cmp_ps(lanes, _mm256_set1_ps((float)leaf.count), _CMP_LT_OQ)));
+	if (_mm256_movemask_ps(mask) == 0)
+		return -1;
+
+	// Find the closest of the hits
+	__m256 hits = _mm256_blendv_ps(_mm256_set1_ps(std::numeric_limits<float>::max()), t, mask);
+	__m256 minimum = _mm256_min_ps(hits, _mm256_permute_ps(hits, _MM_SHUFFLE(2, 3, 0, 1)));
+	minimum = _mm256_min_ps(minimum, _mm256_permute_ps(minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+	minimum = _mm256_min_ps(minimum, _mm256_permute2f128_ps(minimum, minimum, 1));
+
+	int closestLanes = _mm256_movemask_ps(_mm256_and_ps(mask, _mm256_cmp_ps(hits, minimum, _CMP_EQ_OQ)));
+	int lane = 0;
+	while ((closestLanes & (1 << lane)) == 0)
+		lane++;
+
+	closestDistance = _mm256_cvtss_f32(minimum);
+	return (int)s + lane;
+#else
+	int closest = -1;
+	for (uint32_t i = leaf.start; i < leaf.start + leaf.count; i++) {
+		glm::vec3 offset = ray.pos - glm::vec3(centerX[i], centerY[i], centerZ[i]);
+		float b = glm::dot(ray.direction, offset);
+		float discriminant = b * b - glm::dot(offset, offset) + radius[i] * radius[i];
+		if (discriminant < 0)
+			continue;
+
+		float t = -b - sqrt(discriminant);
+		if (t >= 0 && t < closestDistance) {
+			closestDistance = t;
+			closest = (int)i;
+		}
+	}
+	return closest;
+#endif
+}
+
+bool SphereCloud::Intersect(const Ray& ray, HitInfo& hitInfo) const {
+	if (nodes.empty())
+		return false;
+
+	const glm::vec3 inverseDirection = 1.0f / ray.direction;
+	float closestDistance = std::numeric_limits<float>::max();
+	int closestSphere = -1;
+
+	struct StackEntry { uint32_t node; float entryDistance; };
+	StackEntry stack[64];
+	int stackSize = 0;
+
+	float entry;
+	if (!GetBoxEntryDistance(nodes[0].box, ray.pos, inverseDirection, closestDistance, entry))
+		return false;
+	stack[stackSize++] = { 0, entry };
+
+	while (stackSize > 0) {
+		StackEntry current = stack[--stackSize];
+		if (current.entryDistance >= closestDistance)
+			continue;
+
+		const Node& node = nodes[current.node];
+		if (node.count > 0) {
+			int sphere = IntersectLeaf(ray, node, closestDistance);
+			if (sphere >= 0)
+				closestSphere = sphere;
+			continue;
+		}
+
+		// Push the farther child first, so the closer one gets handled first
+		float leftEntry, rightEntry;
+		bool hitLeft = GetBoxEntryDistance(nodes[current.node + 1].box, ray.pos, inverseDirection, closestDistance, leftEntry);
+		bool hitRight = GetBoxEntryDistance(nodes[node.start].box, ray.pos, inverseDirection, closestDistance, rightEntry);
+		if (hitLeft && hitRight) {
+			if (leftEntry < rightEntry) {
+				stack[stackSize++] = { node.start, rightEntry };
+				stack[stackSize++] = { current.node + 1, leftEntry };
+			}
+			else {
+				stack[stackSize++] = { current.node + 1, leftEntry };
+				stack[stackSize++] = { node.start, rightEntry };
+			}
+		}
+		else if (hitLeft)
+			stack[stackSize++] = { current.node + 1, leftEntry };
+		else if (hitRight)
+			stack[stackSize++] = { node.start, rightEntry };
+	}
+
+	if (closestSphere < 0)
+		return false;
+
+	glm::vec3 center = { centerX[closestSphere], centerY[closestSphere], centerZ[closestSphere] };
+	hitInfo.distance = closestDistance;
+	hitInfo.point = ray.pos + closestDistance * ray.direction;
+	hitInfo.normal = glm::normalize(hitInfo.point - center);
+	hitInfo.object = (Object*)this;
+	hitInfo.primitiveIndex = (uint32_t)closestSphere;
+	hitInfo.uv = glm::vec2(glm::atan(hitInfo.normal.x, hitInfo.normal.z) / (2 * glm::pi<float>()) + 0.5f, hitInfo.normal.y * 0.5f + 0.5f);
+	return true;
+}
+
+bool SphereCloud::Occluded(const Ray& ray, float maxDistance) const {
+	if (nodes.empty())
+		return false;
+
+	const glm::vec3 inverseDirection = 1.0f / ray.direction;
+	uint32_t stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		const uint32_t current = stack[--stackSize];
+		const Node& node = nodes[current];
+		float entry;
+		if (!GetBoxEntryDistance(node.box, ray.pos, inverseDirection, maxDistance, entry))
+			continue;
+
+		if (node.count > 0) {
+			float hitDistance = maxDistance;
+			if (IntersectLeaf(ray, node, hitDistance) >= 0)
+				return true;
+			continue;
+		}
+
+		stack[stackSize++] = node.start;
+		stack[stackSize++] = current + 1;
+	}
+	return false;
+}
+
+bool SphereCloud::GetBoundingBox(BoundingBox& outBox) const {
+	if (nodes.empty())
+		return false;
+
+	outBox = nodes[0].box;
+	return true;
+}
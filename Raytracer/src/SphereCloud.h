@@ -0,0 +1,45 @@
+#pragma once
+#include "Object.h"
+
+#include <vector>
+
+// Lots of spheres in one object. The spheres are stored as arrays of each component and have
+// their own BVH whose leaves hold up to LEAF_SIZE spheres, which are tested at once with AVX.
+// A sphere costs 17 bytes, the material is an index to a palette shared by the whole cloud.
+struct SphereCloud : public Object {
+	static constexpr int LEAF_SIZE = 8;
+
+	// Spheres are xyz for the center and w for the radius
+	SphereCloud(const std::vector<glm::vec4>& spheres, const std::vector<uint8_t>& materialIndices, const std::vector<Material>& materials);
+
+	bool Intersect(const Ray& ray, HitInfo& hitInfo) const override;
+	// The nodes are visited in any order, the first sphere found ends the search
+	bool Occluded(const Ray& ray, float maxDistance) const override;
+	bool GetBoundingBox(BoundingBox& outBox) const override;
+	const Material& GetMaterial(const HitInfo& hitInfo) const override { return materials[materialIndices[hitInfo.primitiveIndex]]; }
+
+	size_t GetSphereCount() const { return materialIndices.size(); }
+
+private:
+	struct Node {
+		BoundingBox box;
+		uint32_t start;      // Leaf: first sphere, Branch: index of the right child. The left child is always the next node
+		uint32_t count;      // Zero for branches
+	};
+
+	uint32_t BuildNode(std::vector<uint32_t>& order, uint32_t start, uint32_t end, const std::vector<glm::vec4>& spheres);
+
+	// Return: Index of the closest sphere in the leaf closer than closestDistance, or -1
+	inline int IntersectLeaf(const Ray& ray, const Node& leaf, float& closestDistance) const;
+
+	std::vector<Node> nodes;
+
+	// Padded with LEAF_SIZE spheres, so a leaf can always be loaded in full
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> radius;
+	std::vector<uint8_t> materialIndices;
+
+	std::vector<Material> materials;
+};
@@ -0,0 +1,259 @@
+#include "Wavefront.h"
+#include "Object.h"
+
+#include <limits>
+
+void Wavefront::PathBatch::Reserve(uint32_t size) {
+	for (std::vector<float>* component : { &originX, &originY, &originZ, &directionX, &directionY, &directionZ, &throughputR, &throughputG, &throughputB, &scatterPdf })
+		component->resize(size);
+	screenPosition.resize(size);
+	pixel.resize(size);
+	sample.resize(size);
+}
+inline Ray Wavefront::PathBatch::GetRay(uint32_t path) const {
+	return Ray({ originX[path], originY[path], originZ[path] }, { directionX[path], directionY[path], directionZ[path] });
+}
+inline glm::vec3 Wavefront::PathBatch::GetThroughput(uint32_t path) const {
+	return { throughputR[path], throughputG[path], throughputB[path] };
+}
+inline void Wavefront::PathBatch::Add(const Ray& ray, const glm::vec3& throughput, float scatterPdf, uint32_t screenPosition, uint32_t pixel, uint32_t sample) {
+	originX[count] = ray.pos.x;
+	originY[count] = ray.pos.y;
+	originZ[count] = ray.pos.z;
+	directionX[count] = ray.direction.x;
+	directionY[count] = ray.direction.y;
+	directionZ[count] = ray.direction.z;
+	throughputR[count] = throughput.r;
+	throughputG[count] = throughput.g;
+	throughputB[count] = throughput.b;
+	this->scatterPdf[count] = scatterPdf;
+	this->screenPosition[count] = screenPosition;
+	this->pixel[count] = pixel;
+	this->sample[count] = sample;
+	count++;
+}
+
+void Wavefront::CalculateColors(World& world, const Camera& camera, Sampler& sampler, const glm::vec2* screenPositions, uint32_t count, int samplesPerAxis, uint32_t frame, uint32_t firstSample, glm::vec3* outColors) {
+	// A path continues as at most one secondary ray, so no batch gets bigger than the camera rays
+	const uint32_t pathCount = count * samplesPerAxis * samplesPerAxis;
+	if (paths.originX.size() < pathCount) {
+		paths.Reserve(pathCount);
+		nextPaths.Reserve(pathCount);
+		hits.resize(pathCount + RAY_PACKET_SIZE); // Room for the unused rays of the last packet
+		order.resize(pathCount);
+		keys.resize(pathCount);
+	}
+	light.assign(count, glm::vec3{ 0 });
+
+	sampler.StartFrame(frame, samplesPerAxis * samplesPerAxis);
+	GenerateCameraRays(camera, sampler, screenPositions, count, samplesPerAxis, firstSample);
+	for (int bounceAmount = LIGHT_BOUNCE_AMOUNT; paths.count > 0; bounceAmount--) {
+		// Camera rays are already in screen order
+		if (SORT_SECONDARY_RAYS && bounceAmount < LIGHT_BOUNCE_AMOUNT)
+			SortPaths();
+		else {
+			for (uint32_t i = 0; i < paths.count; i++)
+				order[i] = i;
+		}
+
+		if (PACKET_TRACING && bounceAmount == LIGHT_BOUNCE_AMOUNT)
+			ExtendPackets(world, sampler);
+		else
+			Extend(world, sampler, LIGHT_BOUNCE_AMOUNT - bounceAmount);
+		Shade(world, sampler, bounceAmount);
+		std::swap(paths, nextPaths);
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+		outColors[i] = light[i] / (float)(samplesPerAxis * samplesPerAxis);
+}
+
+void Wavefront::GenerateCameraRays(const Camera& camera, Sampler& sampler, const glm::vec2* screenPositions, uint32_t count, int samplesPerAxis, uint32_t firstSample) {
+	paths.count = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		const uint32_t pixel = World::GetPixelIndex(screenPositions[i].x, screenPositions[i].y);
+		for (uint32_t sample = firstSample; sample < firstSample + samplesPerAxis * samplesPerAxis; sample++) {
+			sampler.StartSample(pixel, sample);
+			const Ray ray = World::CreateCameraRay(screenPositions[i].x, screenPositions[i].y, camera, sampler.Get2D(PIXEL_DIMENSION), sampler.Get2D(LENS_DIMENSION));
+			paths.Add(ray, glm::vec3{ 1 }, 0, i, pixel, sample);
+		}
+	}
+}
+
+inline void Wavefront::SeedThreadRandom([[maybe_unused]] Sampler& sampler, [[maybe_unused]] uint32_t path, [[maybe_unused]] int bounce) {
+#if DETERMINISTIC_RENDERING
+	sampler.StartSample(paths.pixel[path], paths.sample[path]);
+	World::SeedThreadRandom(sampler, bounce);
+#endif
+}
+
+inline void Wavefront::ContinuePath(Sampler& sampler, uint32_t path, int bounce, const Ray& ray, glm::vec3 throughput, float scatterPdf) {
+	if (bounce + 1 >= RUSSIAN_ROULETTE_DEPTH) {
+		sampler.StartSample(paths.pixel[path], paths.sample[path]);
+		if (!World::PlayRussianRoulette(sampler, bounce, throughput))
+			return;
+	}
+	nextPaths.Add(ray, throughput, scatterPdf, paths.screenPosition[path], paths.pixel[path], paths.sample[path]);
+}
+
+// Spreads the lowest 3 bits so there are two zero bits between each
+static inline uint32_t SpreadBits(uint32_t v) {
+	return (v & 1) | (v & 2) << 2 | (v & 4) << 4;
+}
+
+void Wavefront::SortPaths() {
+	glm::vec3 minOrigin{ std::numeric_limits<float>::max() };
+	glm::vec3 maxOrigin{ -std::numeric_limits<float>::max() };
+	for (uint32_t i = 0; i < paths.count; i++) {
+		const glm::vec3 origin = { paths.originX[i], paths.originY[i], paths.originZ[i] };
+		minOrigin = glm::min(minOrigin, origin);
+		maxOrigin = glm::max(maxOrigin, origin);
+	}
+	const glm::vec3 scale = 7.99f / glm::max(maxOrigin - minOrigin, glm::vec3{ 1e-6f });
+
+	// The octant of the direction decides first, then the origin's place on a Morton curve of 8^3 cells inside the batch's bounds.
+	// The batches are small, so a counting sort into the bins is cheaper than comparing keys.
+	binStarts.fill(0);
+	for (uint32_t i = 0; i < paths.count; i++) {
+		const glm::uvec3 cell = glm::uvec3((glm::vec3{ paths.originX[i], paths.originY[i], paths.originZ[i] } - minOrigin) * scale);
+		const uint32_t octant = (paths.directionX[i] < 0) | (paths.directionY[i] < 0) << 1 | (paths.directionZ[i] < 0) << 2;
+		keys[i] = (uint16_t)(octant << 9 | SpreadBits(cell.x) | SpreadBits(cell.y) << 1 | SpreadBits(cell.z) << 2);
+		binStarts[keys[i] + 1]++;
+	}
+	for (uint32_t bin = 1; bin < SORT_BIN_COUNT; bin++)
+		binStarts[bin] += binStarts[bin - 1];
+	for (uint32_t i = 0; i < paths.count; i++)
+		order[binStarts[keys[i]]++] = i;
+}
+
+void Wavefront::Extend(World& world, Sampler& sampler, int bounce) {
+	misses.clear();
+	for (std::vector<uint32_t>& queue : materialQueues)
+		queue.clear();
+
+	for (uint32_t k = 0; k < paths.count; k++) {
+		const uint32_t i = order[k];
+		hits[i] = HitInfo();
+		SeedThreadRandom(sampler, i, bounce);
+		QueueHit(i, world.FindClosestHit(paths.GetRay(i), hits[i]));
+	}
+}
+
+void Wavefront::ExtendPackets(World& world, Sampler& sampler) {
+	misses.clear();
+	for (std::vector<uint32_t>& queue : materialQueues)
+		queue.clear();
+
+	// The samples of a pixel are next to each other, so a packet is of one pixel or two neighbouring ones
+	RayPacket packet;
+	for (uint32_t start = 0; start < paths.count; start += RAY_PACKET_SIZE) {
+		const uint32_t size = glm::min(paths.count - start, (uint32_t)RAY_PACKET_SIZE);
+		for (uint32_t i = 0; i < RAY_PACKET_SIZE; i++) {
+			packet.SetRay(i, paths.GetRay(start + glm::min(i, size - 1)));
+			hits[start + i] = HitInfo();
+		}
+
+		// The packet is always made of the same paths, so they can share the numbers
+		SeedThreadRandom(sampler, start, 0);
+		world.FindClosestHits(packet, &hits[start], (1 << size) - 1);
+		for (uint32_t i = 0; i < size; i++)
+			QueueHit(start + i, hits[start + i].object != nullptr);
+	}
+}
+
+void Wavefront::QueueHit(uint32_t path, bool hit) {
+	if (!hit) {
+		misses.push_back(path);
+		return;
+	}
+
+	const Material& material = hits[path].object->GetMaterial(hits[path]);
+	materialQueues[(int)material.materialType].push_back(path);
+}
+
+void Wavefront::GetDirectionSamples(Sampler& sampler, const std::vector<uint32_t>& queue, int bounce) {
+	if (directionSamples.size() < queue.size()) {
+		directionSamples.resize(queue.size());
+		normals.resize(queue.size());
+		directions.resize(queue.size());
+	}
+
+	// The whole queue at once, so the sampler can do many paths together
+	sampler.Get2D(GetBounceDimension(bounce, BounceDimension::Direction), queue.data(), (uint32_t)queue.size(), paths.pixel.data(), paths.sample.data(), directionSamples.data());
+}
+
+void Wavefront::Shade(World& world, Sampler& sampler, int bounceAmount) {
+	nextPaths.count = 0;
+
+	for (uint32_t i : misses)
+		light[paths.screenPosition[i]] += paths.GetThroughput(i) * world.GetSkyColor(paths.GetRay(i).direction) * world.GetEmissionWeight(paths.GetRay(i), nullptr, paths.scatterPdf[i]);
+
+	for (uint32_t i : materialQueues[(int)MaterialType::DiffuseLight]) {
+		const Material& material = hits[i].object->GetMaterial(hits[i]);
+		light[paths.screenPosition[i]] += paths.GetThroughput(i) * material.emittingColor * world.GetEmissionWeight(paths.GetRay(i), hits[i].object, paths.scatterPdf[i]);
+	}
+
+	// The rest only reflect light, so paths without bounces left end without adding anything
+	if (bounceAmount == 0)
+		return;
+	const int bounce = LIGHT_BOUNCE_AMOUNT - bounceAmount;
+
+	const std::vector<uint32_t>& diffuseQueue = materialQueues[(int)MaterialType::Diffuse];
+	GetDirectionSamples(sampler, diffuseQueue, bounce);
+	for (uint32_t k = 0; k < diffuseQueue.size(); k++)
+		normals[k] = hits[diffuseQueue[k]].normal;
+	SampleCosineHemispheres(directionSamples.data(), normals.data(), (uint32_t)diffuseQueue.size(), directions.data());
+	for (uint32_t k = 0; k < diffuseQueue.size(); k++) {
+		const float lightDarknerFactor = 0.5f;
+		const uint32_t i = diffuseQueue[k];
+		const HitInfo& hitInfo = hits[i];
+		const Material& material = hitInfo.object->GetMaterial(hitInfo);
+
+		// Same as World::GetRayColor
+		const glm::vec3 brdf = lightDarknerFactor * material.texture->GetColorValue(hitInfo.uv, hitInfo.point) / glm::pi<float>();
+		sampler.StartSample(paths.pixel[i], paths.sample[i]);
+		LightSample lightSample;
+		if (world.SampleLight(sampler, bounce, hitInfo.point, lightSample)) {
+			const float lightCosTheta = glm::dot(lightSample.direction, hitInfo.normal);
+			if (lightCosTheta > 0 && world.IsLightVisible(sampler, bounce, hitInfo.point, lightSample))
+				light[paths.screenPosition[i]] += paths.GetThroughput(i) * brdf * lightCosTheta * lightSample.emission
+					* GetMisWeight(lightSample.pdf, GetCosineHemispherePdf(lightCosTheta)) / lightSample.pdf;
+		}
+
+		const float cosTheta = glm::dot(directions[k], hitInfo.normal);
+		const float pdf = GetCosineHemispherePdf(cosTheta);
+		if (pdf <= 0)
+			continue;
+
+		const Ray reflectedRay = Ray::CreateFromSurface(hitInfo.point, directions[k]);
+		ContinuePath(sampler, i, bounce, reflectedRay, paths.GetThroughput(i) * brdf * cosTheta / pdf, pdf);
+	}
+
+	for (uint32_t i : materialQueues[(int)MaterialType::Metal]) {
+		const HitInfo& hitInfo = hits[i];
+		const Material& material = hitInfo.object->GetMaterial(hitInfo);
+		const glm::vec3 direction = { paths.directionX[i], paths.directionY[i], paths.directionZ[i] };
+
+		const Ray reflectedRay = Ray::CreateFromSurface(hitInfo.point, glm::normalize(direction - 2.0f * hitInfo.normal * glm::dot(direction, hitInfo.normal)));
+		ContinuePath(sampler, i, bounce, reflectedRay, paths.GetThroughput(i) * material.texture->GetColorValue(hitInfo.uv, hitInfo.point), 0);
+	}
+
+	const std::vector<uint32_t>& isotropicQueue = materialQueues[(int)MaterialType::Isotropic];
+	GetDirectionSamples(sampler, isotropicQueue, bounce);
+	SampleUnitSpheres(directionSamples.data(), (uint32_t)isotropicQueue.size(), directions.data());
+	for (uint32_t k = 0; k < isotropicQueue.size(); k++) {
+		const float phase = 1.0f / (4.0f * glm::pi<float>());
+		const uint32_t i = isotropicQueue[k];
+		const HitInfo& hitInfo = hits[i];
+		const Material& material = hitInfo.object->GetMaterial(hitInfo);
+		const glm::vec3 albedo = material.texture->GetColorValue(hitInfo.uv, hitInfo.point);
+
+		sampler.StartSample(paths.pixel[i], paths.sample[i]);
+		LightSample lightSample;
+		if (world.SampleLight(sampler, bounce, hitInfo.point, lightSample) && world.IsLightVisible(sampler, bounce, hitInfo.point, lightSample))
+			light[paths.screenPosition[i]] += paths.GetThroughput(i) * albedo * phase * lightSample.emission * GetMisWeight(lightSample.pdf, GetUnitSpherePdf()) / lightSample.pdf;
+
+		const Ray reflectedRay = Ray::CreateFromSurface(hitInfo.point, directions[k]);
+		ContinuePath(sampler, i, bounce, reflectedRay, paths.GetThroughput(i) * albedo * phase / GetUnitSpherePdf(), GetUnitSpherePdf());
+	}
+}
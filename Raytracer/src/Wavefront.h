@@ -0,0 +1,69 @@
+#pragma once
+#include "Constants.h"
+#include "DataUtility.h"
+#include "World.h"
+#include "Sampler.h"
+
+#include <array>
+#include <vector>
+#include <glm.hpp>
+
+// Traces many paths at once in stages, instead of one path at a time to the end like World::GetRayColor.
+// Every stage is one loop over all the paths, so its code and data stay in the cache:
+// camera rays -> closest hits -> shading, one material at a time -> secondary rays -> closest hits -> ...
+// Each thread has its own, the arrays are kept between tiles so they are only allocated once.
+class Wavefront {
+public:
+	// Same as World::CalculateColorForScreenPosition for every screen position
+	void CalculateColors(World& world, const Camera& camera, Sampler& sampler, const glm::vec2* screenPositions, uint32_t count, int samplesPerAxis, uint32_t frame, uint32_t firstSample, glm::vec3* outColors);
+
+private:
+	// Paths stored as arrays of each component
+	struct PathBatch {
+		std::vector<float> originX, originY, originZ;
+		std::vector<float> directionX, directionY, directionZ;
+		std::vector<float> throughputR, throughputG, throughputB;
+		std::vector<float> scatterPdf; // Same as in World::GetRayColor
+		std::vector<uint32_t> screenPosition;
+		std::vector<uint32_t> pixel, sample; // Which sample of which pixel the path is, for the sampler
+		uint32_t count = 0;
+
+		void Reserve(uint32_t size);
+		inline Ray GetRay(uint32_t path) const;
+		inline glm::vec3 GetThroughput(uint32_t path) const;
+		inline void Add(const Ray& ray, const glm::vec3& throughput, float scatterPdf, uint32_t screenPosition, uint32_t pixel, uint32_t sample);
+	};
+
+	void GenerateCameraRays(const Camera& camera, Sampler& sampler, const glm::vec2* screenPositions, uint32_t count, int samplesPerAxis, uint32_t firstSample);
+	void QueueHit(uint32_t path, bool hit);
+	// Orders the paths so that rays starting near each other and going the same way are traced one after another
+	void SortPaths();
+	void Extend(World& world, Sampler& sampler, int bounce);
+	// Same as Extend for camera rays, which go about the same way in groups of RAY_PACKET_SIZE
+	void ExtendPackets(World& world, Sampler& sampler);
+	// Adds the light of the finished paths and writes the continuing ones to the next batch
+	void Shade(World& world, Sampler& sampler, int bounceAmount);
+	// Fills directionSamples with the bounce's direction sample of each path of the queue
+	void GetDirectionSamples(Sampler& sampler, const std::vector<uint32_t>& queue, int bounce);
+	// Same as World::SeedThreadRandom for the path
+	inline void SeedThreadRandom(Sampler& sampler, uint32_t path, int bounce);
+	// Writes the path to the next batch if it survives World::PlayRussianRoulette
+	inline void ContinuePath(Sampler& sampler, uint32_t path, int bounce, const Ray& ray, glm::vec3 throughput, float scatterPdf);
+
+	static constexpr int MATERIAL_TYPE_COUNT = (int)MaterialType::DiffuseLight + 1;
+
+	PathBatch paths;
+	PathBatch nextPaths;
+	static constexpr uint32_t SORT_BIN_COUNT = 8 * 512 + 1;
+
+	std::vector<uint32_t> order; // Paths in the order they are traced
+	std::vector<uint16_t> keys;
+	std::array<uint32_t, SORT_BIN_COUNT> binStarts;
+	std::vector<HitInfo> hits;
+	std::vector<uint32_t> misses;
+	std::array<std::vector<uint32_t>, MATERIAL_TYPE_COUNT> materialQueues; // Paths that hit each type of material
+	std::vector<glm::vec2> directionSamples;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec3> directions;
+	std::vector<glm::vec3> light; // For each screen position
+};
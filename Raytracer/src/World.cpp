@@ -1,6 +1,8 @@
 #include "World.h"
 #include "DataUtility.h"
 #include "Object.h"
+#include "SignedDistanceField.h"
+#include "SphereCloud.h"
 #include "Constants.h"
 
 #include <iostream>
@@ -17,7 +19,7 @@ std::vector<Object*> CreateNoBoundingBoxObjects(float time) {
 	objs.push_back(new YPlane(0, Material::CreateMetal(Texture::CreateCheckered({1.0f, 1.0f, 1.0f}, {0.2f, 0.6f, 0.3f}))));
 	return objs;
 }
-BVH_Node* CreateBoundingBoxObjects(float time) {
+BVH_Node* CreateBoundingBoxObjects(float time, LightList& outLights) {
 	std::vector<Object*> objects = std::vector<Object*>();
 
 #if 1
@@ -25,11 +27,33 @@ BVH_Node* CreateBoundingBoxObjects(float time) {
 	objects.push_back(new Sphere{ {8, 2, -4}, 2, Material::CreateDiffuse(Texture::CreateCheckered({ 0.6f, 0.3f, 0.2f }, { 1.0f, 1.0f, 1.0f})) });
 	objects.push_back(new ApplyMovement({ 0, 5, 0 }, new ApplyXRotation(90, new PolygonMesh("src/stb_image/tree.obj", 10, Material::CreateDiffuse(Texture::CreateFromImage("src/stb_image/tree_texture.png"))))));
 
+#if SDF_DEMO
+	SDFSmoothUnion blob = SDFSmoothUnion(std::make_shared<SDFTorus>(glm::vec3{ -7, 1.5f, -3 }, 1.5f, 0.4f), std::make_shared<SDFSphere>(glm::vec3{ -7, 2.2f, -3 }, 0.8f), 0.6f);
+	objects.push_back(new SDFObject(std::make_shared<SDFBrickGrid>(blob, 0.05f), Material::CreateMetal(Texture::CreateColored({ 0.9f, 0.7f, 0.4f }))));
+#endif
+
 	for (int i = 0; i < 15; i++)
 		objects.push_back(new Sphere{ 
 			glm::vec3{i * 2.5f+10, glm::sin(i * 78.0f) * 1.9f + 1.0f, 15.0f * glm::sin(i * 34.4f)}, 
 			glm::sin(i * 78.0f) * 1.9f + 1.0f, 
 			Material::CreateDiffuse(Texture::CreateColored(0.5f + (glm::vec3{ glm::sin(i), glm::sin(i * 1.7f), glm::sin(i) } * 0.5f)))});
+
+#if SPHERE_CLOUD_DEMO
+	// A field of pebbles behind the tree
+	std::vector<glm::vec4> pebbles;
+	std::vector<uint8_t> pebbleMaterials;
+	for (int i = 0; i < 50000; i++) {
+		float pebbleRadius = 0.05f + 0.1f * glm::fract(glm::sin(i * 12.9898f) * 43758.5453f);
+		glm::vec2 pos = glm::vec2{ glm::fract(glm::sin(i * 78.233f) * 43758.5453f), glm::fract(glm::sin(i * 39.425f) * 43758.5453f) };
+		pebbles.push_back({ pos.x * 30.0f - 15.0f, pebbleRadius, pos.y * 20.0f + 15.0f, pebbleRadius });
+		pebbleMaterials.push_back((uint8_t)(i % 3));
+	}
+	objects.push_back(new SphereCloud(pebbles, pebbleMaterials, {
+		Material::CreateDiffuse(Texture::CreateColored({ 0.5f, 0.5f, 0.5f })),
+		Material::CreateDiffuse(Texture::CreateColored({ 0.6f, 0.5f, 0.4f })),
+		Material::CreateMetal(Texture::CreateColored({ 0.8f, 0.8f, 0.8f }))
+	}));
+#endif
 #else
 	objects.push_back(new AxisAlignedCube{ {-6, 0, -6}, {-5, 6, 6 }, Material::CreateDiffuse(Texture::CreateColored({ 0.8f, 0.2f, 0.3f })) });
 	objects.push_back(new AxisAlignedCube{ {5, 0, -6}, {6, 6, 6 }, Material::CreateDiffuse(Texture::CreateColored({ 0.2f, 0.8f, 0.3f })) });
@@ -40,59 +64,68 @@ BVH_Node* CreateBoundingBoxObjects(float time) {
 	objects.push_back( new ApplyXRotation(20.0f, new Fog({ -3, 1, 0 }, 3.0f, 0.5f, Texture::CreateColored({1.0f, 1.0f, 0.0f}))));
 #endif
 
+	outLights.Build(objects);
+
 	// This object now owns the pointers, and is responsible for deleting them
 	return new BVH_Node(objects);
 }
 
-World::World(float time)
-  : camera({ glm::vec3{ 0, 3, -10 }, glm::vec3{ 0, 0, 1 } }), 
-	skybox(std::string("src/stb_image/skybox12.png")), 
-	rootNode(CreateBoundingBoxObjects(time)),
+World::World(std::shared_ptr<Skybox> skybox, float time)
+  : skybox(skybox), 
+	rootNode(CreateBoundingBoxObjects(time, lights)),
 	noBoundingBoxObjects(CreateNoBoundingBoxObjects(time))
-{}
+{
+	lights.AddSkybox(this->skybox.get());
+}
 
 World::~World() {
 	for (Object* obj : noBoundingBoxObjects)
 		delete obj;
+	delete rootNode;
 }
 
-void World::CreateWithNewTime(float time) {
-	for (Object* obj : noBoundingBoxObjects)
-		delete obj;
-	delete rootNode;
+glm::vec3 World::CalculateColorForScreenPosition(float screenX, float screenY, const Camera& camera, Sampler& sampler, int samplesPerAxis, uint32_t frame, uint32_t firstSample) {
+	glm::vec3 color{ 0 };
+
+	const uint32_t sampleCount = samplesPerAxis * samplesPerAxis;
+	sampler.StartFrame(frame, sampleCount);
+	for (uint32_t sample = firstSample; sample < firstSample + sampleCount; sample++) {
+		sampler.StartSample(GetPixelIndex(screenX, screenY), sample);
+		const Ray ray = CreateCameraRay(screenX, screenY, camera, sampler.Get2D(PIXEL_DIMENSION), sampler.Get2D(LENS_DIMENSION));
+		color += GetRayColor(ray, LIGHT_BOUNCE_AMOUNT, sampler);
+	}
+
+	return color / (float)sampleCount;
+}
 
-	rootNode = CreateBoundingBoxObjects(time);
-	noBoundingBoxObjects = CreateNoBoundingBoxObjects(time);
+void World::SeedThreadRandom([[maybe_unused]] const Sampler& sampler, [[maybe_unused]] int bounce, [[maybe_unused]] BounceDimension dimension) {
+#if DETERMINISTIC_RENDERING
+	GetThreadRandom() = Random(sampler.GetSeed(GetBounceDimension(bounce, dimension)));
+#endif
 }
 
-glm::u8vec3 World::CalculateColorForScreenPosition(int x, int y) {
+Ray World::CreateCameraRay(float x, float y, const Camera& camera, glm::vec2 pixelSample, glm::vec2 lensSample) {
 	Ray ray;
 	glm::vec2 onePixelOffset = { -(1.0f / WINDOW_WIDTH) * ((float)WINDOW_WIDTH / WINDOW_HEIGHT) * FIELD_OF_VIEW, -(1.0f / WINDOW_HEIGHT) * FIELD_OF_VIEW };
 	glm::vec2 offset = { -((float)x / WINDOW_WIDTH - 0.5f) * ((float)WINDOW_WIDTH/WINDOW_HEIGHT) * FIELD_OF_VIEW, -((float)y / WINDOW_HEIGHT - 0.5f) * FIELD_OF_VIEW };
-	glm::vec3 color{ 0 };
-
-	for (int x = 0; x < SAMPLES_PER_PIXEL_AXIS; x++) {
-		for (int y = 0; y < SAMPLES_PER_PIXEL_AXIS; y++) {
-			// anti aliasing
-			ray.direction = camera.GetForwardVector();
-			ray.direction += camera.GetUDirection() * (offset.x + onePixelOffset.x * ((float)x / SAMPLES_PER_PIXEL_AXIS))
-						   + camera.GetVDirection() * (offset.y + onePixelOffset.y * ((float)y / SAMPLES_PER_PIXEL_AXIS));
-			ray.direction = glm::normalize(ray.direction);
-
-			// depth of field
-			glm::vec2 offset = GetRandomUnitCirclePoint() * DEPTH_OF_FIELD_INTENSITY;
-			glm::vec3 worldOffset = camera.GetUDirection() * offset.x + camera.GetVDirection() * offset.y;
-			ray.pos = camera.pos;
-			ray.pos += worldOffset;
-			ray.direction -= worldOffset / FOCUS_DISTANCE;
-			ray.direction = glm::normalize(ray.direction);
-
-			color += GetRayColor(ray, LIGHT_BOUNCE_AMOUNT);
-		}
-	}
 
-	color /= SAMPLES_PER_PIXEL_AXIS * SAMPLES_PER_PIXEL_AXIS;
+	// anti aliasing
+	ray.direction = camera.GetForwardVector();
+	ray.direction += camera.GetUDirection() * (offset.x + onePixelOffset.x * pixelSample.x)
+				   + camera.GetVDirection() * (offset.y + onePixelOffset.y * pixelSample.y);
+	ray.direction = glm::normalize(ray.direction);
+
+	// depth of field
+	glm::vec2 lensOffset = SampleUnitDisk(lensSample) * DEPTH_OF_FIELD_INTENSITY;
+	glm::vec3 worldOffset = camera.GetUDirection() * lensOffset.x + camera.GetVDirection() * lensOffset.y;
+	ray.pos = camera.pos;
+	ray.pos += worldOffset;
+	ray.direction -= worldOffset / FOCUS_DISTANCE;
+	ray.direction = glm::normalize(ray.direction);
+	return ray;
+}
 
+glm::u8vec3 World::ToDisplayColor(glm::vec3 color) {
 	// A good approximate for gamma correction that also clamps values from 0-infinity to 0-1. For this reason it also preserves highly lit areas.
 	const float steepness = 5.0f;
 	color = 1.0f - 1.0f / (1.0f + steepness * color);
@@ -101,93 +134,147 @@ glm::u8vec3 World::CalculateColorForScreenPosition(int x, int y) {
 	return color8Bit;
 }
 
-glm::vec3 World::GetRayColor(const Ray& ray, int bounceAmount) {
-	HitInfo hitInfo;
+bool World::FindClosestHit(const Ray& ray, HitInfo& hitInfo) {
 	bool hit = rootNode->Intersect(ray, hitInfo);
-	{
-		HitInfo thisHitInfo;
+	HitInfo thisHitInfo;
 
-		for (int i = 0; i < noBoundingBoxObjects.size(); i++) {
-			if (!noBoundingBoxObjects[i]->Intersect(ray, thisHitInfo))
-				continue;
+	for (int i = 0; i < noBoundingBoxObjects.size(); i++) {
+		if (!noBoundingBoxObjects[i]->Intersect(ray, thisHitInfo))
+			continue;
 
-			if (thisHitInfo.distance < hitInfo.distance) {
-				hit = true;
-				hitInfo = thisHitInfo;
-			}
+		if (thisHitInfo.distance < hitInfo.distance) {
+			hit = true;
+			hitInfo = thisHitInfo;
 		}
 	}
+	return hit;
+}
 
-	if (!hit) {
-		return SKYBOX_BRIGHTNESS * GetSkyboxPixel(ray.direction);
+bool World::Occluded(const Ray& ray, float maxDistance) {
+	if (rootNode->Occluded(ray, maxDistance))
+		return true;
+	for (Object* object : noBoundingBoxObjects) {
+		if (object->Occluded(ray, maxDistance))
+			return true;
 	}
-	
-	const Material& material = hitInfo.object->material;
-	switch (material.materialType)
-	{
-		case MaterialType::Diffuse: {
-			const float lightDarknerFactor = 0.5f;
-
-			if (bounceAmount == 0)
-				return glm::vec3{ 0 };
+	return false;
+}
 
-			Ray reflectedRay;
-			reflectedRay.direction = glm::normalize(hitInfo.normal + GetRandomUnitSpherePoint());
-			reflectedRay.pos = hitInfo.point;
+void World::FindClosestHits(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask) {
+	rootNode->IntersectPacket(packet, hitInfos, activeMask);
+	for (Object* object : noBoundingBoxObjects)
+		object->IntersectPacket(packet, hitInfos, activeMask);
+}
 
-			glm::vec3 pixelColor = lightDarknerFactor * GetRayColor(reflectedRay, bounceAmount - 1) * material.texture->GetColorValue(hitInfo.uv, hitInfo.point);
+glm::vec3 World::GetRayColor(const Ray& cameraRay, int bounceAmount, Sampler& sampler) {
+	// One loop iteration per bounce. The throughput is how much of the light found further along the path reaches the camera.
+	Ray ray = cameraRay;
+	glm::vec3 throughput{ 1 };
+	glm::vec3 color{ 0 };
+	float scatterPdf = 0; // Of the direction of the ray, 0 if lights couldn't have been sampled instead
+	for (int bounce = 0; ; bounce++) {
+		SeedThreadRandom(sampler, bounce);
+
+		HitInfo hitInfo;
+		if (!FindClosestHit(ray, hitInfo))
+			return color + throughput * GetSkyColor(ray.direction) * GetEmissionWeight(ray, nullptr, scatterPdf);
+
+		const Material& material = hitInfo.object->GetMaterial(hitInfo);
+		if (material.materialType == MaterialType::DiffuseLight)
+			return color + throughput * material.emittingColor * GetEmissionWeight(ray, hitInfo.object, scatterPdf);
+		if (material.materialType == MaterialType::None || bounce == bounceAmount)
+			return color;
+
+		switch (material.materialType)
+		{
+			case MaterialType::Diffuse: {
+				const float lightDarknerFactor = 0.5f;
+				const glm::vec3 brdf = lightDarknerFactor * material.texture->GetColorValue(hitInfo.uv, hitInfo.point) / glm::pi<float>();
+
+				LightSample lightSample;
+				if (SampleLight(sampler, bounce, hitInfo.point, lightSample)) {
+					const float lightCosTheta = glm::dot(lightSample.direction, hitInfo.normal);
+					if (lightCosTheta > 0 && IsLightVisible(sampler, bounce, hitInfo.point, lightSample))
+						color += throughput * brdf * lightCosTheta * lightSample.emission
+							* GetMisWeight(lightSample.pdf, GetCosineHemispherePdf(lightCosTheta)) / lightSample.pdf;
+				}
+
+				const glm::vec3 direction = SampleCosineHemisphere(sampler.Get2D(GetBounceDimension(bounce, BounceDimension::Direction)), hitInfo.normal);
+
+				// Lambertian, the cosine of the light cancels with the pdf
+				const float cosTheta = glm::dot(direction, hitInfo.normal);
+				scatterPdf = GetCosineHemispherePdf(cosTheta);
+				if (scatterPdf <= 0)
+					return color;
+
+				throughput *= brdf * cosTheta / scatterPdf;
+				ray = Ray::CreateFromSurface(hitInfo.point, direction);
+				break;
+			}
+			case MaterialType::Metal: {
+				throughput *= material.texture->GetColorValue(hitInfo.uv, hitInfo.point);
+				ray = Ray::CreateFromSurface(hitInfo.point, glm::normalize(ray.direction - 2.0f * hitInfo.normal * glm::dot(ray.direction, hitInfo.normal)));
+				scatterPdf = 0;
+				break;
+			}
+			case MaterialType::Isotropic: {
+				const float phase = 1.0f / (4.0f * glm::pi<float>());
+				const glm::vec3 albedo = material.texture->GetColorValue(hitInfo.uv, hitInfo.point);
 
-			return pixelColor;
-		}
-		case MaterialType::Metal: {
-			if (bounceAmount == 0)
-				return glm::vec3{ 0 };
+				LightSample lightSample;
+				if (SampleLight(sampler, bounce, hitInfo.point, lightSample) && IsLightVisible(sampler, bounce, hitInfo.point, lightSample))
+					color += throughput * albedo * phase * lightSample.emission * GetMisWeight(lightSample.pdf, GetUnitSpherePdf()) / lightSample.pdf;
 
-			Ray reflectedRay;
-			reflectedRay.pos = hitInfo.point;
-			reflectedRay.direction = glm::normalize(ray.direction - 2.0f * hitInfo.normal * glm::dot(ray.direction, hitInfo.normal));
-			glm::vec3 newRayCol = GetRayColor(reflectedRay, bounceAmount - 1);
+				const glm::vec3 direction = SampleUnitSphere(sampler.Get2D(GetBounceDimension(bounce, BounceDimension::Direction)));
 
-			glm::vec3 pixelColor = material.texture->GetColorValue(hitInfo.uv, hitInfo.point) * newRayCol;
-			return pixelColor;
-		}
-		case MaterialType::DiffuseLight: {
-			return material.emittingColor;
+				// Scatters the same way in every direction, so the phase function and the pdf cancel
+				scatterPdf = GetUnitSpherePdf();
+				throughput *= albedo * phase / scatterPdf;
+				ray = Ray::CreateFromSurface(hitInfo.point, direction);
+				break;
+			}
+			default:
+				break;
 		}
-		case MaterialType::Isotropic: {
-			if (bounceAmount == 0)
-				return glm::vec3{ 0 };
-
-			Ray reflectedRay;
-			reflectedRay.pos = hitInfo.point;
-			reflectedRay.direction = GetRandomUnitSpherePoint();
 
-			glm::vec3 newRayCol = GetRayColor(reflectedRay, bounceAmount - 1);
-			return material.texture->GetColorValue(hitInfo.uv, hitInfo.point) * newRayCol;
-		}
-		case MaterialType::None:
-			return glm::vec3{ 0 };
+		if (!PlayRussianRoulette(sampler, bounce, throughput))
+			return color;
 	}
 }
 
-glm::vec3 World::GetSkyboxPixel(const glm::vec3& direction) {
-	glm::vec2 uv = glm::vec2(glm::atan(direction.x, direction.z) / (2*glm::pi<float>()) + 0.5f, direction.y * 0.5f + 0.5f);
-	glm::vec2 pixel = { uv.x * skybox.size.x, uv.y * skybox.size.y };
+bool World::SampleLight(Sampler& sampler, int bounce, const glm::vec3& point, LightSample& outSample) {
+	if (lights.IsEmpty())
+		return false;
+	return lights.Sample(point, sampler.Get1D(GetBounceDimension(bounce, BounceDimension::LightChoice)), sampler.Get2D(GetBounceDimension(bounce, BounceDimension::Light)), outSample);
+}
+
+bool World::IsLightVisible(const Sampler& sampler, int bounce, const glm::vec3& point, const LightSample& lightSample) {
+	// Stops short of the light, which would otherwise hide itself
+	const float lightSurfaceMargin = 0.001f;
 
-	int intPixelX = (int)pixel.x;
-	int intPixelY = (int)pixel.y;
+	SeedThreadRandom(sampler, bounce, BounceDimension::Shadow);
+	return !Occluded(Ray::CreateFromSurface(point, lightSample.direction), lightSample.distance - lightSurfaceMargin);
+}
 
-	return GetSkyboxPixel(intPixelX, intPixelY);
+float World::GetEmissionWeight(const Ray& ray, const Object* object, float scatterPdf) const {
+	if (scatterPdf <= 0)
+		return 1;
+	const float lightPdf = lights.GetPdf(ray, object);
+	return lightPdf > 0 ? GetMisWeight(scatterPdf, lightPdf) : 1;
 }
-glm::vec3 World::GetSkyboxPixel(int x, int y) {
-	int index = 3 * (int)(y * skybox.size.x + x);
-	uint8_t c1 = skybox.skyboxImageData[index];
-	uint8_t c2 = skybox.skyboxImageData[index + 1];
-	uint8_t c3 = skybox.skyboxImageData[index + 2];
 
-	float f1 = c1;
-	float f2 = c2;
-	float f3 = c3;
+bool World::PlayRussianRoulette(Sampler& sampler, int bounce, glm::vec3& throughput) {
+	if (bounce + 1 < RUSSIAN_ROULETTE_DEPTH)
+		return true;
 
-	return glm::vec3{ f1, f2, f3 } / 255.0f;
-}
\ No newline at end of file
+	// Dark paths end more often, the ones that survive carry the light of the ended ones
+	const float survivalProbability = glm::min(GetLuminance(throughput), 0.95f);
+	if (sampler.Get1D(GetBounceDimension(bounce, BounceDimension::RussianRoulette)) >= survivalProbability)
+		return false;
+	throughput /= survivalProbability;
+	return true;
+}
+
+glm::vec3 World::GetSkyColor(const glm::vec3& direction) {
+	return SKYBOX_BRIGHTNESS * skybox->GetPixel(direction);
+}
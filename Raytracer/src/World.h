@@ -2,31 +2,57 @@
 #include "Constants.h"
 #include "DataUtility.h"
 #include "Object.h"
+#include "Light.h"
+#include "Sampler.h"
 
 #include <iostream>
 #include <array>
 #include <vector>
+#include <memory>
 #include <glm.hpp>
 
 
+// Everything in the scene at one point in time. Scene updates create a new world instead of changing this one,
+// so render threads can keep using it. The skybox is shared between the worlds.
 class World {
 public:
-	World(float time = 0);
+	World(std::shared_ptr<Skybox> skybox, float time = 0);
 	~World();
+	// Return: The mean of the samples, before ToDisplayColor. The sample indices start from firstSample, so passes can continue each other
+	glm::vec3 CalculateColorForScreenPosition(float x, float y, const Camera& camera, Sampler& sampler, int samplesPerAxis = SAMPLES_PER_PIXEL_AXIS, uint32_t frame = 0, uint32_t firstSample = 0);
+	// Takes the numbers of the sample the sampler was started on. The path ends after bounceAmount bounces at most
+	glm::vec3 GetRayColor(const Ray& ray, int bounceAmount, Sampler& sampler);
 
-	void CreateWithNewTime(float time);
-	glm::u8vec3 CalculateColorForScreenPosition(int x, int y);
-	glm::vec3 GetRayColor(const Ray& ray, int bounceAmount = 0);
-	Camera& GetWorldCamera() { return camera; }
+	// The parts of calculating a color, for renderers that don't go one path at a time
+	static uint32_t GetPixelIndex(float x, float y) { return (uint32_t)y * WINDOW_WIDTH + (uint32_t)x; }
+	// The samples are from 0 to 1, one places the ray inside the pixel and the other on the lens
+	static Ray CreateCameraRay(float x, float y, const Camera& camera, glm::vec2 pixelSample, glm::vec2 lensSample);
+	// With DETERMINISTIC_RENDERING the fog's numbers are seeded from the sample's, so the order of the paths doesn't matter
+	static void SeedThreadRandom(const Sampler& sampler, int bounce, BounceDimension dimension = BounceDimension::Fog);
+	// Ends paths that carry little light after RUSSIAN_ROULETTE_DEPTH bounces, and makes the ones that go on carry more to keep the mean.
+	// Return: Does the path go on
+	static bool PlayRussianRoulette(Sampler& sampler, int bounce, glm::vec3& throughput);
+	static glm::u8vec3 ToDisplayColor(glm::vec3 color);
+	bool FindClosestHit(const Ray& ray, HitInfo& hitInfo);
 
-private:
-	glm::vec3 GetSkyboxPixel(const glm::vec3& direction);
-	inline glm::vec3 GetSkyboxPixel(int x, int y);
+	// Next event estimation: the light of a point is also gathered by aiming at a light, and weighted against the bounces that hit it with MIS
+	// Return: Was there a light to aim at
+	bool SampleLight(Sampler& sampler, int bounce, const glm::vec3& point, LightSample& outSample);
+	// Traces a shadow ray from the point to the light
+	bool IsLightVisible(const Sampler& sampler, int bounce, const glm::vec3& point, const LightSample& lightSample);
+	// Return: The MIS weight of the light of an object the ray hit, or of the skybox if the object is null.
+	// Takes the pdf the ray was scattered with, 0 if lights couldn't have been sampled instead
+	float GetEmissionWeight(const Ray& ray, const Object* object, float scatterPdf) const;
+	// A ray of the packet hit something if its hitInfo has an object
+	void FindClosestHits(const RayPacket& packet, HitInfo* hitInfos, uint32_t activeMask);
+	// Return: Is there anything on the ray closer than maxDistance. Faster than FindClosestHit, it stops at the first hit
+	bool Occluded(const Ray& ray, float maxDistance);
+	glm::vec3 GetSkyColor(const glm::vec3& direction);
 
 private:
 	std::vector<Object*> noBoundingBoxObjects;
+	LightList lights; // Before rootNode, it is filled while the objects are created
 	BVH_Node* rootNode;
 
-	Skybox skybox;
-	Camera camera;
+	std::shared_ptr<Skybox> skybox;
 };
\ No newline at end of file